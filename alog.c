@@ -0,0 +1,253 @@
+/**
+ * Asynchronous logging through per-thread single-producer rings
+ */
+#include "alog.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ALOG_OUTBUF (64 * 1024) // writer batches records into one write
+#define ALOG_IDLE_NS 2000000    // writer naps this long when rings are empty
+
+typedef struct {
+  unsigned short len;    // bytes in text
+  char text[ALOG_LINE]; // formatted record, newline included
+} alog_slot;
+
+/**
+ * single-producer single-consumer ring owned by one logging thread
+ */
+typedef struct alog_ring {
+  _Alignas(64) atomic_uint head; // next slot to drain, written by the writer
+  _Alignas(64) atomic_uint tail; // next slot to fill, written by the owner
+  atomic_uint dropped;           // records lost to a full ring
+  unsigned reported;             // drops already reported by the writer
+  atomic_int closed;             // owner thread has exited
+  struct alog_ring *next;
+  alog_slot slots[ALOG_RING_SLOTS];
+} alog_ring;
+
+int alog_level = ALOG_INFO;
+
+static int out_fd = -1;
+static _Atomic(alog_ring *) rings; // every ring, newest first
+static __thread alog_ring *my_ring;
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_t writer;
+static atomic_int stopping;
+static int running;
+
+static const char *level_names[] = {"off", "error", "info", "debug"};
+
+/**
+ * runs at thread exit: let the writer free the ring once it is drained
+ */
+static void ring_release(void *arg) {
+  alog_ring *rp = arg;
+  atomic_store_explicit(&rp->closed, 1, memory_order_release);
+}
+
+static void make_key(void) { pthread_key_create(&ring_key, ring_release); }
+
+/**
+ * the calling thread's ring, created and published on first use
+ */
+static alog_ring *get_ring(void) {
+  alog_ring *rp, *old;
+
+  if ((rp = my_ring)) {
+    return rp;
+  }
+  if (!(rp = calloc(1, sizeof(alog_ring)))) {
+    return NULL;
+  }
+  pthread_once(&key_once, make_key);
+  pthread_setspecific(ring_key, rp);
+
+  // lock-free push onto the ring list
+  old = atomic_load(&rings);
+  do {
+    rp->next = old;
+  } while (!atomic_compare_exchange_weak(&rings, &old, rp));
+  return my_ring = rp;
+}
+
+/**
+ * the "ts=... level=... " that starts every record; returns its length
+ */
+static int format_prefix(char *buf, int level) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  return snprintf(buf, ALOG_LINE, "ts=%ld.%06ld level=%s ", (long)now.tv_sec,
+                  now.tv_nsec / 1000, level_names[level]);
+}
+
+/**
+ * append one record; a newline is added
+ */
+void alog(int level, const char *fmt, ...) {
+  alog_ring *rp;
+  alog_slot *sp;
+  unsigned tail;
+  va_list ap;
+  int n, m;
+
+  if (!alog_enabled(level) || !running || !(rp = get_ring())) {
+    return;
+  }
+
+  tail = atomic_load_explicit(&rp->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&rp->head, memory_order_acquire) ==
+      ALOG_RING_SLOTS) { /* full: drop rather than wait for the writer */
+    atomic_fetch_add_explicit(&rp->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  sp = &rp->slots[tail & (ALOG_RING_SLOTS - 1)];
+
+  n = format_prefix(sp->text, level);
+  va_start(ap, fmt);
+  m = vsnprintf(sp->text + n, ALOG_LINE - n, fmt, ap);
+  va_end(ap);
+  n = (m < 0) ? n : (n + m < ALOG_LINE - 1) ? n + m : ALOG_LINE - 2;
+  sp->text[n++] = '\n';
+  sp->len = n;
+
+  atomic_store_explicit(&rp->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * write out whatever the batch buffer holds, all of it even if a write is
+ * short or a signal interrupts it; on an error the batch is lost
+ */
+static void flush_out(char *out, size_t *used) {
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < *used) {
+    if ((n = write(out_fd, out + done, *used - done)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    done += n;
+  }
+  *used = 0;
+}
+
+/**
+ * copy every pending record of `rp` into the batch buffer; returns the
+ * number of records drained
+ */
+static int drain_ring(alog_ring *rp, char *out, size_t *used) {
+  unsigned head, tail, dropped;
+  alog_slot *sp;
+  int n = 0;
+
+  head = atomic_load_explicit(&rp->head, memory_order_relaxed);
+  tail = atomic_load_explicit(&rp->tail, memory_order_acquire);
+  for (; head != tail; head++, n++) {
+    sp = &rp->slots[head & (ALOG_RING_SLOTS - 1)];
+    if (*used + sp->len > ALOG_OUTBUF) {
+      flush_out(out, used);
+    }
+    memcpy(out + *used, sp->text, sp->len);
+    *used += sp->len;
+    atomic_store_explicit(&rp->head, head + 1, memory_order_release);
+  }
+
+  dropped = atomic_load_explicit(&rp->dropped, memory_order_relaxed);
+  if (dropped != rp->reported) {
+    if (*used + 2 * ALOG_LINE > ALOG_OUTBUF) { /* prefix and message */
+      flush_out(out, used);
+    }
+    *used += format_prefix(out + *used, ALOG_ERROR);
+    *used += snprintf(out + *used, ALOG_LINE, "msg=\"dropped %u log records\"\n",
+                      dropped - rp->reported);
+    rp->reported = dropped;
+  }
+  return n;
+}
+
+/**
+ * background thread: drain all rings, nap when there is nothing to do
+ */
+static void *writer_thread(void *vargp) {
+  static char out[ALOG_OUTBUF];
+  struct timespec nap = {0, ALOG_IDLE_NS};
+  alog_ring *rp, *prev, *next;
+  size_t used = 0;
+  int n, stop;
+
+  (void)vargp;
+  do {
+    stop = atomic_load(&stopping);
+    n = 0;
+    for (prev = NULL, rp = atomic_load(&rings); rp; rp = next) {
+      next = rp->next;
+      n += drain_ring(rp, out, &used);
+
+      // owners only ever push at the head, so any later ring can be
+      // unlinked once its thread is gone and it is empty
+      if (prev && atomic_load_explicit(&rp->closed, memory_order_acquire) &&
+          atomic_load(&rp->tail) == atomic_load(&rp->head)) {
+        prev->next = next;
+        free(rp);
+      } else {
+        prev = rp;
+      }
+    }
+    flush_out(out, &used);
+    if (n == 0 && !stop) {
+      nanosleep(&nap, NULL);
+    }
+  } while (!stop || n > 0);
+  return NULL;
+}
+
+/**
+ * start the writer thread; records at or below `level` go to `fd`
+ */
+void alog_init(int level, int fd) {
+  alog_level = level;
+  out_fd = fd;
+  atomic_store(&stopping, 0);
+  if (level > ALOG_OFF && pthread_create(&writer, NULL, writer_thread, NULL) ==
+                              0) {
+    running = 1;
+  }
+}
+
+/**
+ * drain every ring and stop the writer thread
+ */
+void alog_deinit(void) {
+  if (!running) {
+    return;
+  }
+  atomic_store(&stopping, 1);
+  pthread_join(writer, NULL);
+  running = 0;
+}
+
+/**
+ * map "off", "error", "info" or "debug" to a level, -1 if unknown
+ */
+int alog_parse_level(const char *name) {
+  int i;
+
+  for (i = ALOG_OFF; i <= ALOG_DEBUG; i++) {
+    if (!strcmp(name, level_names[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
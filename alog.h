@@ -0,0 +1,43 @@
+#ifndef INCLUDED_ALOG_H
+#define INCLUDED_ALOG_H
+
+/**
+ * Asynchronous logging: each thread formats records into its own lock-free
+ * ring, and a background thread drains all rings to the output descriptor.
+ * A full ring drops records (and counts them) rather than block the caller.
+ */
+
+#define ALOG_LINE 256        // max bytes per record, newline included
+#define ALOG_RING_SLOTS 1024 // records per thread ring, power of two
+
+enum { ALOG_OFF, ALOG_ERROR, ALOG_INFO, ALOG_DEBUG };
+
+extern int alog_level; // records above this level are discarded
+
+/**
+ * start the writer thread; records at or below `level` go to `fd`
+ */
+void alog_init(int level, int fd);
+
+/**
+ * drain every ring and stop the writer thread
+ */
+void alog_deinit(void);
+
+/**
+ * map "off", "error", "info" or "debug" to a level, -1 if unknown
+ */
+int alog_parse_level(const char *name);
+
+/**
+ * append one record; a newline is added
+ */
+void alog(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * cheap check to skip building arguments nobody will see
+ */
+static inline int alog_enabled(int level) { return level <= alog_level; }
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * adder.c - a CGI program that sums two numbers, e.g. /cgi-bin/adder?15&213
+ * Serves one request under plain CGI, or many when tiny runs it in a pool.
+ */
+#include "../cgi_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(void) {
+  char args[MAXLINE], content[MAXLINE], *p;
+  int n1, n2;
+
+  while (cgi_worker_accept(args, MAXLINE) == 0) {
+    // extract the two arguments
+    n1 = n2 = 0;
+    if ((p = strchr(args, '&'))) {
+      *p = '\0';
+      n1 = atoi(args);
+      n2 = atoi(p + 1);
+    }
+
+    // make the response body
+    sprintf(content, "Welcome to add.com: ");
+    sprintf(content + strlen(content), "The Internet addition portal.\r\n<p>");
+    sprintf(content + strlen(content), "The answer is: %d + %d = %d\r\n<p>",
+            n1, n2, n1 + n2);
+    sprintf(content + strlen(content), "Thanks for visiting!\r\n");
+
+    // generate the rest of the HTTP response
+    printf("Connection: close\r\n");
+    printf("Content-length: %d\r\n", (int)strlen(content));
+    printf("Content-type: text/html\r\n\r\n");
+    printf("%s", content);
+    cgi_worker_finish();
+  }
+  exit(0);
+}
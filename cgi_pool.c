@@ -0,0 +1,330 @@
+/**
+ * A FastCGI-style pool of long-lived CGI worker processes
+ */
+#include "cgi_pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ; /* Defined by libc */
+
+/**
+ * start one worker for `filename`, connected to tiny over a socketpair
+ */
+static int spawn_worker(cgi_worker *wp, char *filename) {
+  int sv[2], null_fd;
+  char fd_str[16], *argv[] = {filename, NULL}; // named in ps
+
+  // both ends close on exec, so no other worker inherits tiny's end
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    return -1;
+  }
+
+  if ((wp->pid = fork()) < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+  if (wp->pid == 0) { /* child */
+    // between requests stdout is /dev/null: stray output never reaches the
+    // log that is tiny's stdout
+    if ((null_fd = open("/dev/null", O_WRONLY)) >= 0) {
+      dup2(null_fd, STDOUT_FILENO);
+      close(null_fd);
+    }
+    signal(SIGPIPE, SIG_DFL); // tiny ignores it; that would survive execve
+    // keep only the worker's end across execve
+    fcntl(sv[1], F_SETFD, 0);
+    sprintf(fd_str, "%d", sv[1]);
+    setenv(CGI_POOL_ENV, fd_str, 1);
+    execve(filename, argv, environ);
+    _exit(1);
+  }
+
+  close(sv[1]);
+  wp->sock = sv[0];
+  wp->outstanding = 0;
+  return 0;
+}
+
+/**
+ * close the channel to a worker and reap it
+ */
+static void stop_worker(cgi_worker *wp) {
+  if (wp->pid < 0) {
+    return;
+  }
+  // closing the channel makes cgi_worker_accept return -1
+  close(wp->sock);
+  waitpid(wp->pid, NULL, 0);
+  wp->pid = -1;
+  wp->sock = -1;
+  wp->outstanding = 0;
+}
+
+/**
+ * collect replies without blocking; a worker that hung up is reaped
+ */
+static void drain_replies(cgi_worker *wp) {
+  cgi_reply_hdr reply;
+  ssize_t n;
+
+  while ((n = recv(wp->sock, &reply, sizeof(reply), MSG_DONTWAIT)) ==
+         sizeof(reply)) {
+    if (wp->outstanding > 0) {
+      wp->outstanding--;
+    }
+  }
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    stop_worker(wp);
+  }
+}
+
+/**
+ * the workers for `filename`, NULL if it is not registered
+ */
+static cgi_prog *find_prog(cgi_pool *cp, char *filename) {
+  int i;
+
+  for (i = 0; i < cp->n_progs; i++) {
+    if (!strcmp(cp->progs[i].filename, filename)) {
+      return &cp->progs[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * send one request frame without blocking, passing the client connection
+ * along with it. Returns 0 once sent, -2 if the channel is full right now,
+ * -1 if it is broken (or out of step after a partial frame).
+ */
+static int send_request(cgi_worker *wp, char *cgi_args, const char *head,
+                        size_t head_len, int fd) {
+  cgi_req_hdr hdr;
+  struct msghdr msg;
+  struct iovec iov[3];
+  struct cmsghdr *cmsg;
+  char control[CMSG_SPACE(sizeof(int))];
+  ssize_t n;
+
+  hdr.head_len = head_len;
+  hdr.len = strlen(cgi_args);
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = (void *)head;
+  iov[1].iov_len = hdr.head_len;
+  iov[2].iov_base = cgi_args;
+  iov[2].iov_len = hdr.len;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 3;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  // never wait on a worker that is not reading: the caller forks instead.
+  // MSG_NOSIGNAL: a dead worker shows up as EPIPE, not SIGPIPE
+  while ((n = sendmsg(wp->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0 &&
+         errno == EINTR) {
+  }
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return -2;
+  }
+  if (n != (ssize_t)(sizeof(hdr) + hdr.head_len + hdr.len)) {
+    return -1;
+  }
+  wp->outstanding++;
+  return 0;
+}
+
+/**
+ * server side: keep `n_workers` processes per CGI program, started lazily
+ */
+void cgi_pool_init(cgi_pool *cp, int n_workers) {
+  cp->n_workers = n_workers;
+  cp->n_progs = 0;
+}
+
+/**
+ * run `filename` in the pool; its workers start on its first request
+ */
+int cgi_pool_register(cgi_pool *cp, const char *filename) {
+  cgi_prog *pp;
+  int i;
+
+  if (cp->n_progs == CGI_POOL_MAX_PROGS || strlen(filename) >= MAXLINE) {
+    return -1;
+  }
+  pp = &cp->progs[cp->n_progs];
+  if (!(pp->workers = calloc(cp->n_workers, sizeof(cgi_worker)))) {
+    return -1;
+  }
+  strcpy(pp->filename, filename);
+  for (i = 0; i < cp->n_workers; i++) {
+    pp->workers[i].pid = -1;
+    pp->workers[i].sock = -1;
+  }
+  cp->n_progs++;
+  return 0;
+}
+
+/**
+ * hand connection `fd` and `cgi_args` to the least loaded worker running
+ * `filename`. Returns 0 once the request is queued, -1 if `filename` is not
+ * registered or no worker could take it without waiting.
+ */
+int cgi_pool_dispatch(cgi_pool *cp, char *filename, char *cgi_args,
+                      const char *head, size_t head_len, int fd) {
+  cgi_prog *pp;
+  cgi_worker *wp, *best = NULL;
+  int i, attempt, rc;
+
+  if (!(pp = find_prog(cp, filename))) {
+    return -1;
+  }
+
+  // one retry covers a worker that died since its last request
+  for (attempt = 0; attempt < 2; attempt++) {
+    for (i = 0; i < cp->n_workers; i++) {
+      wp = &pp->workers[i];
+      if (wp->pid > 0) {
+        drain_replies(wp);
+      }
+      if (wp->pid < 0 && spawn_worker(wp, filename) < 0) {
+        continue;
+      }
+      if (wp->outstanding >= CGI_POOL_MAX_OUTSTANDING) {
+        continue; /* stuck, or just busy: do not pile more on */
+      }
+      if (!best || wp->outstanding < best->outstanding) {
+        best = wp;
+      }
+    }
+    if (!best) {
+      return -1;
+    }
+    if ((rc = send_request(best, cgi_args, head, head_len, fd)) != -1) {
+      return rc == 0 ? 0 : -1;
+    }
+    // a worker that broke mid-frame may be past hearing a closed channel
+    kill(best->pid, SIGKILL);
+    stop_worker(best);
+    best = NULL;
+  }
+  return -1;
+}
+
+/**
+ * close every channel and reap the workers
+ */
+void cgi_pool_deinit(cgi_pool *cp) {
+  int i, j;
+
+  for (i = 0; i < cp->n_progs; i++) {
+    for (j = 0; j < cp->n_workers; j++) {
+      stop_worker(&cp->progs[i].workers[j]);
+    }
+    free(cp->progs[i].workers);
+  }
+  cp->n_progs = 0;
+}
+
+static int worker_sock = -2; // -2 until looked up, -1 outside a pool
+static int saved_stdout = -1; // tiny's stdout, restored between requests
+
+/**
+ * worker side: wait for the next request, copy its args to `cgi_args`, set
+ * QUERY_STRING, send tiny's response head and point stdout at the client.
+ * Returns 0 for a request, -1 when tiny closes the channel. Run outside a
+ * pool (plain fork + execve) it yields the single request from the
+ * environment, so one binary serves both.
+ */
+int cgi_worker_accept(char *cgi_args, size_t max_len) {
+  static int served = 0;
+  cgi_req_hdr hdr;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char control[CMSG_SPACE(sizeof(int))], head[MAXLINE], *env;
+  int client_fd = -1;
+  ssize_t n;
+
+  if (worker_sock == -2) {
+    env = getenv(CGI_POOL_ENV);
+    worker_sock = env ? atoi(env) : -1;
+  }
+
+  if (worker_sock < 0) { /* plain CGI: one request, from the environment */
+    if (served++) {
+      return -1;
+    }
+    env = getenv("QUERY_STRING");
+    snprintf(cgi_args, max_len, "%s", env ? env : "");
+    return 0;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  while ((n = recvmsg(worker_sock, &msg, MSG_WAITALL)) < 0 && errno == EINTR) {
+  }
+  if (n != sizeof(hdr)) {
+    return -1;
+  }
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&client_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  if (client_fd < 0 || hdr.head_len > sizeof(head) || hdr.len >= max_len ||
+      rio_readn(worker_sock, head, hdr.head_len) != hdr.head_len ||
+      rio_readn(worker_sock, cgi_args, hdr.len) != hdr.len) {
+    return -1;
+  }
+  rio_writen(client_fd, head, hdr.head_len); // a failure shows on stdout too
+  cgi_args[hdr.len] = '\0';
+  setenv("QUERY_STRING", cgi_args, 1);
+
+  // redirect stdout to client, as fork + execve would have
+  fflush(stdout);
+  if (saved_stdout < 0) {
+    saved_stdout = dup(STDOUT_FILENO);
+  }
+  dup2(client_fd, STDOUT_FILENO);
+  close(client_fd);
+  return 0;
+}
+
+/**
+ * flush the response, detach stdout from the client and acknowledge
+ */
+void cgi_worker_finish(void) {
+  cgi_reply_hdr reply;
+
+  fflush(stdout);
+  if (worker_sock < 0) {
+    return;
+  }
+
+  // dropping our copy of the client fd lets the connection close
+  dup2(saved_stdout, STDOUT_FILENO);
+  reply.status = 0;
+  rio_writen(worker_sock, &reply, sizeof(reply));
+}
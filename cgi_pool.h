@@ -0,0 +1,94 @@
+#ifndef INCLUDED_CGI_POOL_H
+#define INCLUDED_CGI_POOL_H
+
+#include "rio.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CGI_POOL_MAX_PROGS 16     // distinct CGI programs that can be pooled
+#define CGI_POOL_ENV "CGI_POOL_FD" // tells a worker which fd is its channel
+#define CGI_POOL_MAX_OUTSTANDING 8 // unanswered requests per worker, at most
+
+/**
+ * Wire format between tiny and a worker, over a Unix stream socket.
+ * tiny -> worker: a request header followed by `head_len` bytes of HTTP
+ *                 response head, for the worker to send first, and `len`
+ *                 bytes of CGI args; the client connection rides along the
+ *                 header as SCM_RIGHTS.
+ * worker -> tiny: a reply header once the response has been written.
+ */
+typedef struct {
+  uint32_t head_len; // bytes of response head that follow
+  uint32_t len;      // bytes of CGI args after those
+} cgi_req_hdr;
+
+typedef struct {
+  uint32_t status; // 0 if the request was served
+} cgi_reply_hdr;
+
+/**
+ * one long-lived worker process
+ */
+typedef struct {
+  pid_t pid;       // -1 if not running
+  int sock;        // tiny's end of the channel
+  int outstanding; // requests sent but not yet acknowledged
+} cgi_worker;
+
+/**
+ * the workers running one CGI program
+ */
+typedef struct {
+  char filename[MAXLINE];
+  cgi_worker *workers;
+} cgi_prog;
+
+typedef struct {
+  int n_workers; // workers per program
+  int n_progs;   // programs started so far
+  cgi_prog progs[CGI_POOL_MAX_PROGS];
+} cgi_pool;
+
+/**
+ * server side: keep `n_workers` processes per registered CGI program,
+ * started lazily
+ */
+void cgi_pool_init(cgi_pool *cp, int n_workers);
+
+/**
+ * run `filename` in the pool. Only programs built around cgi_worker_accept
+ * can be: anything else would never answer, so it keeps fork + execve.
+ * Returns -1 if CGI_POOL_MAX_PROGS are registered already.
+ */
+int cgi_pool_register(cgi_pool *cp, const char *filename);
+
+/**
+ * hand connection `fd` and `cgi_args` to a worker running `filename`, which
+ * sends `head` (the status line and headers so far) before its own output.
+ * Never blocks: returns 0 once the request is queued, -1 if `filename` is
+ * not registered or every worker is backed up or broken, in which case the
+ * caller should fall back to fork + execve.
+ */
+int cgi_pool_dispatch(cgi_pool *cp, char *filename, char *cgi_args,
+                      const char *head, size_t head_len, int fd);
+
+/**
+ * close every channel and reap the workers
+ */
+void cgi_pool_deinit(cgi_pool *cp);
+
+/**
+ * worker side: wait for the next request, copy its args to `cgi_args`, set
+ * QUERY_STRING, send tiny's response head and point stdout at the client.
+ * Returns 0 for a request, -1 when tiny closes the channel. Run outside a
+ * pool (plain fork + execve) it yields the single request from the
+ * environment, so one binary serves both.
+ */
+int cgi_worker_accept(char *cgi_args, size_t max_len);
+
+/**
+ * flush the response, detach stdout from the client and acknowledge
+ */
+void cgi_worker_finish(void);
+
+#endif
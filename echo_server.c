@@ -1,192 +1,712 @@
+/**
+ * echo_server.c - a line echo server on select or epoll event loops
+ *
+ *   gcc -O2 -pthread -o echo_server echo_server.c alog.c hist.c metrics.c \
+ *       rio.c sock.c timer_wheel.c
+ *   ./echo_server -e -n 4 8001
+ */
+#define _GNU_SOURCE
+#include "alog.h"
+#include "metrics.h"
 #include "rio.h"
+#include "sock.h"
 #include "sys/select.h"
+#include "timer_wheel.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#define LISTENQ 1024 /* Second argument to listen() */
 typedef struct sockaddr SA;
 
+#define TICK_MS 10      /* timer wheel resolution */
+#define MAX_EVENTS 256  /* epoll events taken per wakeup */
+#define MIN_CONNS 64    /* initial size of the connection table */
+#define RESERVED_FDS 8  /* stdio, listener, epoll and spares */
+#define HANDOFF_SLOTS 1024 /* accepted connections queued per reactor */
+#define MAX_REACTORS 256
+
+enum { TIMEOUT_IDLE, TIMEOUT_LINE, TIMEOUT_WRITE };
+
+static const char *timeout_names[] = {"idle", "line", "write"};
+static unsigned timeout_ms[] = {60000, 10000, 10000}; // by TIMEOUT_*
+
+struct pool;
+
 /**
- * represents a pool of connected descriptors
+ * one client connection
  */
 typedef struct {
-  int max_fd;                   // largest descriptor in read_set
-  fd_set read_set;              // set of all active descriptors
-  fd_set ready_set;             // subset of descriptors ready for reading
-  int n_ready;                  // number of ready descriptors from select
-  int max_i;                    // high water index into client array
-  int client_fd[FD_SETSIZE];    // set of active descriptors
-  rio_t client_rio[FD_SETSIZE]; // set of active read buffers
+  int fd;                 // -1 if the slot is free
+  rio_t rio;              // read buffer, kept across wakeups
+  tw_timer timer;         // idle, line or write timeout
+  int timeout;            // which TIMEOUT_* the timer is armed for
+  int out_off;            // echo bytes the socket has not taken yet:
+  int out_len;            // out[out_off .. out_len)
+  char out[RIO_BUFSIZE];
+  struct pool *p;         // pool this connection belongs to
+} conn;
+
+/**
+ * accepted descriptors on their way from the acceptor thread to one
+ * reactor: single producer, single consumer, so two counters suffice
+ */
+typedef struct {
+  _Alignas(64) atomic_uint head; // next slot to take, written by the reactor
+  _Alignas(64) atomic_uint tail; // next slot to fill, written by the acceptor
+  int fds[HANDOFF_SLOTS];
+} handoff;
+
+/**
+ * represents a pool of connected descriptors, served by one reactor thread
+ */
+typedef struct pool {
+  int id;                    // reactor number, for the log
+  pthread_t tid;
+  int listen_fd;             // accepted from directly, -1 if handed off
+  int wake_fd;               // eventfd the acceptor signals, -1 if none
+  handoff queue;             // connections handed off to this reactor
+  int epoll_fd;              // -1 to multiplex with select instead
+  int max_fd;                // largest descriptor in read_set
+  fd_set read_set;           // descriptors waiting for input
+  fd_set write_set;          // descriptors with echo still to send
+  fd_set ready_set;          // subset of read_set ready for reading
+  fd_set ready_wset;         // subset of write_set ready for writing
+  int n_ready;               // number of ready descriptors from select
+  conn **conns;              // by descriptor, allocated on first use
+  int n_conns;               // size of conns
+  int n_clients;             // active connections
+  int max_clients;           // cap, from RLIMIT_NOFILE (and FD_SETSIZE)
+  timer_wheel timers;        // one timer per connection
 } pool;
 
-int byte_cnt = 0; // total bytes received by server
+static atomic_int dump_requested; // SIGUSR1 seen, metrics not yet dumped
 
 /**
-Return a listening descriptor that is ready to receive connection requests on
-`port`
-*/
-int open_listenfd(char *port) {
-  struct addrinfo hints, *listp, *p;
-  int listenfd, rc, optval = 1;
+ * Initializes the pool of active clients. With several reactors the
+ * clients are handed off through `queue` rather than accepted directly.
+ */
+void init_pool(int listen_fd, int use_epoll, int n_reactors, pool *p) {
+  struct rlimit rl;
+  struct epoll_event ev = {EPOLLIN, {.ptr = NULL}};
+
+  // initially, no connected descriptors
+  p->n_clients = 0;
+  p->n_conns = MIN_CONNS;
+  p->conns = calloc(p->n_conns, sizeof(conn *));
+  tw_init(&p->timers, TICK_MS);
+
+  // as many clients as we may open descriptors, raising the soft limit as
+  // far as we are allowed; select cannot watch past FD_SETSIZE at all
+  getrlimit(RLIMIT_NOFILE, &rl);
+  if (rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+  }
+  p->max_clients = (rl.rlim_cur > 1 << 20) ? 1 << 20 : (int)rl.rlim_cur;
+  if (!use_epoll && p->max_clients > FD_SETSIZE) {
+    p->max_clients = FD_SETSIZE;
+  }
+  p->max_clients = (p->max_clients - RESERVED_FDS) / n_reactors;
 
-  // get list of potential server addresses
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_socktype = SOCK_STREAM;             // accept connections
-  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; // ... on any IP addresses
-  hints.ai_flags |= AI_NUMERICSERV;            // ... using port number
-  if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
-    fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port,
-            gai_strerror(rc));
-    return -2;
+  p->listen_fd = (n_reactors > 1) ? -1 : listen_fd;
+  p->wake_fd = -1;
+  atomic_init(&p->queue.head, 0);
+  atomic_init(&p->queue.tail, 0);
+  if (n_reactors > 1 &&
+      (p->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+    perror("eventfd");
+    exit(1);
   }
 
-  // walk the list for one that we can bind to
-  for (p = listp; p; p = p->ai_next) {
-    // create socket descriptor
-    if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
-      continue; // socket failed, try next
+  // initially, listenfd (or the hand-off eventfd) is only member of select
+  // read set
+  p->epoll_fd = -1;
+  p->max_fd = (p->listen_fd >= 0) ? p->listen_fd : p->wake_fd;
+  FD_ZERO(&p->read_set);
+  FD_ZERO(&p->write_set);
+  FD_SET(p->max_fd, &p->read_set);
+  if (use_epoll) {
+    // ... or of the epoll set; a NULL ptr marks the listener, a pointer to
+    // the queue the eventfd
+    if ((p->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+      perror("epoll_create1");
+      exit(1);
+    }
+    if (p->listen_fd >= 0) {
+      epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->listen_fd, &ev);
+    } else {
+      ev.data.ptr = &p->queue;
+      epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->wake_fd, &ev);
     }
+  }
+}
+
+void app_error(char *msg) /* Application error */
+{
+  fprintf(stderr, "%s\n", msg);
+  exit(0);
+}
 
-    // eliminate "address already in use" error from bind
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
-               sizeof(int));
+/**
+ * the table slot for `fd`, growing the table to reach it
+ */
+static conn *conn_slot(pool *p, int fd) {
+  int n = p->n_conns;
+  conn **conns;
 
-    // bind descriptor to address
-    if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) {
-      break; // success
+  if (fd >= n) {
+    while (fd >= n) {
+      n *= 2;
+    }
+    if (!(conns = realloc(p->conns, n * sizeof(conn *)))) {
+      return NULL;
     }
+    memset(conns + p->n_conns, 0, (n - p->n_conns) * sizeof(conn *));
+    p->conns = conns;
+    p->n_conns = n;
+  }
+  if (!p->conns[fd]) {
+    p->conns[fd] = malloc(sizeof(conn));
+  }
+  return p->conns[fd];
+}
+
+/**
+ * watch `c` for input, or only for the socket draining its pending echo
+ */
+static void set_interest(conn *c, int want_write) {
+  struct epoll_event ev = {want_write ? EPOLLOUT : EPOLLIN, {.ptr = c}};
 
-    close(listenfd); // bind failed, try next
+  if (c->p->epoll_fd >= 0) {
+    epoll_ctl(c->p->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+  } else if (want_write) {
+    FD_CLR(c->fd, &c->p->read_set);
+    FD_SET(c->fd, &c->p->write_set);
+  } else {
+    FD_CLR(c->fd, &c->p->write_set);
+    FD_SET(c->fd, &c->p->read_set);
   }
+}
 
-  // cleanup
-  freeaddrinfo(listp);
-  if (!p) {
-    return -1;
+/**
+ * close a connection and free its slot
+ */
+static void remove_client(conn *c, const char *reason) {
+  alog(ALOG_INFO, "event=close fd=%d reactor=%d reason=%s", c->fd, c->p->id,
+       reason);
+  tw_cancel(&c->p->timers, &c->timer);
+  // closing drops the descriptor from the epoll set too
+  close(c->fd);
+  if (c->p->epoll_fd < 0) {
+    FD_CLR(c->fd, &c->p->read_set);
+    FD_CLR(c->fd, &c->p->write_set);
+  }
+  c->p->n_clients--;
+  c->fd = -1;
+}
+
+/**
+ * timer callback: the connection missed its deadline
+ */
+static void client_timeout(tw_timer *tp) {
+  conn *c = tw_entry(tp, conn, timer);
+  metrics_add(METRIC_ERRORS, 1);
+  remove_client(c, timeout_names[c->timeout]);
+}
+
+/**
+ * arm the deadline that matches what the connection is waiting for: the
+ * socket to drain our echo, the rest of a started line, or a new line.
+ * A line's deadline runs from its first byte, so dripping bytes slowly
+ * does not extend it; only finishing a line (`progress`) does.
+ */
+static void update_timeout(conn *c, int progress) {
+  int timeout = (c->out_off < c->out_len) ? TIMEOUT_WRITE
+                : (c->rio.rio_cnt > 0)    ? TIMEOUT_LINE
+                                          : TIMEOUT_IDLE;
+
+  if (timeout == TIMEOUT_LINE && c->timeout == TIMEOUT_LINE && !progress &&
+      tw_armed(&c->timer)) {
+    return;
+  }
+  c->timeout = timeout;
+  tw_arm(&c->p->timers, &c->timer, timeout_ms[timeout]);
+}
+
+/**
+ * Add new client connection to the pool
+ */
+void add_client(int conn_fd, pool *p) {
+  struct epoll_event ev = {EPOLLIN, {.ptr = NULL}};
+  conn *c;
+
+  // past the cap, turn the client away rather than exiting
+  if (p->n_clients >= p->max_clients ||
+      (p->epoll_fd < 0 && conn_fd >= FD_SETSIZE) ||
+      !(c = conn_slot(p, conn_fd))) {
+    alog(ALOG_ERROR, "event=reject fd=%d reason=too_many_clients clients=%d",
+         conn_fd, p->n_clients);
+    close(conn_fd);
+    return;
   }
 
-  // make it a listening socket ready to accept connection requests
-  if (listen(listenfd, LISTENQ) < 0) {
-    close(listenfd);
+  // add connected descriptor to pool
+  c->fd = conn_fd;
+  c->p = p;
+  c->out_off = c->out_len = 0;
+  rio_readinitb(&c->rio, conn_fd);
+  tw_timer_init(&c->timer, client_timeout);
+  update_timeout(c, 1);
+  p->n_clients++;
+  metrics_add(METRIC_CONNS, 1);
+
+  // never block on one client: reads and writes return EAGAIN instead
+  fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) | O_NONBLOCK);
+
+  // add descriptor to descriptor set
+  if (p->epoll_fd >= 0) {
+    ev.data.ptr = c;
+    epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, conn_fd, &ev);
+  } else {
+    FD_SET(conn_fd, &p->read_set);
+    if (conn_fd > p->max_fd) {
+      p->max_fd = conn_fd;
+    }
+  }
+}
+
+/**
+ * accept one connection and log it; -1 once none is pending
+ */
+static int accept_client(int listen_fd) {
+  char host[NI_MAXHOST], port[NI_MAXSERV];
+  socklen_t client_len = sizeof(struct sockaddr_storage);
+  struct sockaddr_storage client_addr;
+  int conn_fd;
+
+  if ((conn_fd = accept4(listen_fd, (SA *)&client_addr, &client_len,
+                         SOCK_CLOEXEC)) < 0) {
+    if (errno == EMFILE || errno == ENFILE) {
+      // out of descriptors: turn the client away rather than spin
+      if (sock_shed(listen_fd) == 0) {
+        alog(ALOG_ERROR, "event=reject reason=out_of_fds");
+        metrics_add(METRIC_ERRORS, 1);
+      }
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      alog(ALOG_ERROR, "event=accept_error error=\"%s\"", strerror(errno));
+    }
     return -1;
   }
+  if (alog_enabled(ALOG_INFO)) {
+    getnameinfo((SA *)&client_addr, client_len, host, NI_MAXHOST, port,
+                NI_MAXSERV, NI_NUMERICHOST | NI_NUMERICSERV);
+    alog(ALOG_INFO, "event=accept fd=%d client=%s port=%s", conn_fd, host,
+         port);
+  }
+  return conn_fd;
+}
+
+/**
+ * accept every pending connection; the listening socket is nonblocking
+ */
+static void accept_clients(pool *p) {
+  int conn_fd;
 
-  return listenfd;
+  while ((conn_fd = accept_client(p->listen_fd)) >= 0) {
+    add_client(conn_fd, p);
+  }
 }
 
 /**
- * Initializes the pool of active clients
+ * acceptor side: queue `conn_fd` for reactor `p` and wake it; -1 if its
+ * queue is full
  */
-void init_pool(int listen_fd, pool *p) {
-  // initially, no connected descriptors
-  int i;
-  p->max_i = -1;
-  for (i = 0; i < FD_SETSIZE; i++) {
-    p->client_fd[i] = -1;
+static int handoff_push(pool *p, int conn_fd) {
+  unsigned tail = atomic_load_explicit(&p->queue.tail, memory_order_relaxed);
+  uint64_t one = 1;
+
+  if (tail - atomic_load_explicit(&p->queue.head, memory_order_acquire) ==
+      HANDOFF_SLOTS) {
+    return -1;
   }
+  p->queue.fds[tail % HANDOFF_SLOTS] = conn_fd;
+  atomic_store_explicit(&p->queue.tail, tail + 1, memory_order_release);
+  write(p->wake_fd, &one, sizeof(one));
+  return 0;
+}
 
-  // initially, listenfd is only member of select read set
-  p->max_fd = listen_fd;
-  FD_ZERO(&p->read_set);
-  FD_SET(listen_fd, &p->read_set);
+/**
+ * reactor side: add every connection handed off since the last wakeup
+ */
+static void take_clients(pool *p) {
+  unsigned head = atomic_load_explicit(&p->queue.head, memory_order_relaxed);
+  uint64_t count;
+
+  // reset the eventfd first, so a push racing with the drain wakes us again
+  read(p->wake_fd, &count, sizeof(count));
+  while (head != atomic_load_explicit(&p->queue.tail, memory_order_acquire)) {
+    add_client(p->queue.fds[head % HANDOFF_SLOTS], p);
+    atomic_store_explicit(&p->queue.head, ++head, memory_order_release);
+  }
 }
 
-void app_error(char *msg) /* Application error */
-{
-  fprintf(stderr, "%s\n", msg);
-  exit(0);
+/**
+ * echo every complete line already buffered with a single write, straight
+ * from the read buffer; whatever the socket does not take waits in `out`.
+ * Returns how many bytes were echoed, -1 if the connection failed.
+ */
+static int echo_lines(conn *c) {
+  uint64_t start = metrics_now_ns();
+  char *lines;
+  ssize_t n, sent = 0;
+
+  if (c->out_off < c->out_len || (n = rio_getlinesb(&c->rio, &lines)) == 0) {
+    return 0;
+  }
+  metrics_add(METRIC_REQUESTS, 1);
+  alog(ALOG_DEBUG, "event=recv fd=%d reactor=%d bytes=%zd", c->fd, c->p->id,
+       n);
+
+  if ((sent = write(c->fd, lines, n)) < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      return -1;
+    }
+    sent = 0;
+  }
+  metrics_add(METRIC_BYTES_OUT, sent);
+  // the next read reuses the buffer, so keep our own copy of the rest
+  if (sent < n) {
+    memcpy(c->out, lines + sent, n - sent);
+    c->out_off = 0;
+    c->out_len = n - sent;
+  }
+  metrics_latency(metrics_now_ns() - start);
+  return n;
 }
 
 /**
- * Add new client connection to the pool
+ * serve one ready connection; returns a reason to close it, or NULL.
+ * `*echoed` is set to how many bytes of complete lines were echoed.
  */
-void add_client(int conn_fd, pool *p) {
-  int i;
-  p->n_ready--;
-  for (i = 0; i < FD_SETSIZE; i++) { /* find an available slot */
-    if (p->client_fd[i] < 0) {
-      // add connected descriptor to pool
-      p->client_fd[i] = conn_fd;
-      rio_readinitb(&p->client_rio[i], conn_fd);
-
-      // add descriptor to descriptor set
-      FD_SET(conn_fd, &p->read_set);
-
-      if (conn_fd > p->max_fd) {
-        p->max_fd = conn_fd;
-      }
-      if (i > p->max_i) {
-        p->max_i = i;
+static const char *serve_client(conn *c, int readable, int writable,
+                                int *echoed) {
+  ssize_t n;
+  char buf[RIO_BUFSIZE];
+
+  if (writable) {
+    if ((n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off)) < 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      return "error";
+    }
+    n = (n > 0) ? n : 0;
+    c->out_off += n;
+    metrics_add(METRIC_BYTES_OUT, n);
+  }
+
+  if (readable) {
+    if ((n = rio_fillb(&c->rio)) == 0) { /* EOF detected */
+      // because client has closed its end of the connection; echo what is
+      // left of an unterminated last line
+      n = rio_readnb(&c->rio, buf, c->rio.rio_cnt);
+      if (n > 0 && (n = write(c->fd, buf, n)) > 0) {
+        metrics_add(METRIC_BYTES_OUT, n);
       }
-      break;
+      return "eof";
+    }
+    if (n > 0) {
+      metrics_add(METRIC_BYTES_IN, n);
     }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return "error";
+    }
+  }
+
+  if ((*echoed = echo_lines(c)) < 0) {
+    return "error";
+  }
+  return NULL;
+}
+
+/**
+ * handle readiness on one connection, then update its interest and timer
+ */
+static void handle_client(conn *c, int readable, int writable) {
+  int pending = c->out_off < c->out_len, echoed;
+  const char *reason;
+
+  if ((reason = serve_client(c, readable, writable, &echoed))) {
+    if (strcmp(reason, "eof")) {
+      metrics_add(METRIC_ERRORS, 1);
+    }
+    remove_client(c, reason);
+    return;
   }
 
-  if (i == FD_SETSIZE) { /* could NOT find an empty slot */
-    app_error("add_client error: Too many clients!");
+  // while echo is pending, stop reading: the client must drain it first
+  if (c->out_off < c->out_len) {
+    if (!pending) {
+      set_interest(c, 1);
+    }
+  } else {
+    c->out_off = c->out_len = 0;
+    if (pending) {
+      set_interest(c, 0);
+    }
   }
+  update_timeout(c, echoed > 0);
 }
 
+/**
+ * select: scan the watched descriptors for the ready ones
+ */
 void check_clients(pool *p) {
-  int i, conn_fd, n;
-  char buf[MAXLINE];
-  rio_t rio;
+  int fd, readable, writable;
+  conn *c;
+
+  for (fd = 0; (fd <= p->max_fd) && (p->n_ready > 0); fd++) {
+    if (fd >= p->n_conns || !(c = p->conns[fd]) || c->fd < 0) {
+      continue;
+    }
+
+    // if descriptor is ready, echo every complete line buffered for it
+    readable = FD_ISSET(fd, &p->ready_set);
+    writable = FD_ISSET(fd, &p->ready_wset);
+    if (readable || writable) {
+      p->n_ready -= readable + writable;
+      handle_client(c, readable, writable);
+    }
+  }
+}
+
+/**
+ * SIGUSR1 handler: ask whichever loop wakes up next to dump the metrics
+ */
+static void request_dump(int sig) {
+  (void)sig;
+  atomic_store(&dump_requested, 1);
+}
 
-  for (i = 0; (i <= p->max_i) && (p->n_ready > 0); i++) {
-    conn_fd = p->client_fd[i];
-    rio = p->client_rio[i];
+/**
+ * write the metrics of all threads to stderr, if SIGUSR1 asked for them
+ */
+static void check_dump(void) {
+  metrics_snapshot *snap;
+  char buf[2048];
+  size_t len;
+
+  if (!atomic_load_explicit(&dump_requested, memory_order_relaxed) ||
+      !atomic_exchange(&dump_requested, 0) ||
+      !(snap = malloc(sizeof(metrics_snapshot)))) {
+    return;
+  }
+  metrics_snapshot_take(snap);
+  if ((len = metrics_format(snap, buf, sizeof(buf))) >= sizeof(buf)) {
+    len = sizeof(buf) - 1;
+  }
+  write(STDERR_FILENO, buf, len);
+  free(snap);
+}
 
-    // if descriptor is read, echo a text line from it
-    if ((conn_fd > 0) && (FD_ISSET(conn_fd, &p->ready_set))) {
+/**
+ * select loop; each wakeup costs as much as the largest descriptor
+ */
+static void select_loop(pool *p) {
+  struct timeval tv;
+  int wait_ms;
+
+  while (1) {
+    // wait for listening/connected descriptors to become ready, or for
+    // the next timer to come due
+    p->ready_set = p->read_set;
+    p->ready_wset = p->write_set;
+    if ((wait_ms = tw_timeout_ms(&p->timers)) >= 0) {
+      tv.tv_sec = wait_ms / 1000;
+      tv.tv_usec = (wait_ms % 1000) * 1000;
+    }
+    p->n_ready = select(p->max_fd + 1, &p->ready_set, &p->ready_wset, NULL,
+                        wait_ms >= 0 ? &tv : NULL);
+    if (p->n_ready < 0) {
+      p->n_ready = 0;
+      FD_ZERO(&p->ready_set);
+      FD_ZERO(&p->ready_wset);
+    }
+
+    // if listening descriptor is ready, add new clients to pool
+    if (p->listen_fd >= 0 && FD_ISSET(p->listen_fd, &p->ready_set)) {
+      p->n_ready--;
+      accept_clients(p);
+    }
+    // ... likewise for clients the acceptor handed us
+    if (p->wake_fd >= 0 && FD_ISSET(p->wake_fd, &p->ready_set)) {
       p->n_ready--;
-      if ((n = rio_readlineb(&rio, buf, MAXLINE))) {
-        byte_cnt += n;
-        printf("Server received %d (%d total) bytes on fd %d\n", n, byte_cnt,
-               conn_fd);
-        rio_writen(conn_fd, buf, n);
-      } else { /* EOF detected, remove descriptor from pool */
-        // because client has closed its end of the connection
-        close(conn_fd);
-        FD_CLR(conn_fd, &p->read_set);
-        p->client_fd[i] = -1;
+      take_clients(p);
+    }
+
+    // echo the buffered lines of each ready connected descriptor
+    check_clients(p);
+
+    // close connections that missed a deadline
+    tw_advance(&p->timers);
+    check_dump();
+  }
+}
+
+/**
+ * epoll loop; each wakeup costs only as much as the events it returns
+ */
+static void epoll_loop(pool *p) {
+  struct epoll_event events[MAX_EVENTS];
+  conn *c;
+  int i, n;
+
+  while (1) {
+    n = epoll_wait(p->epoll_fd, events, MAX_EVENTS,
+                   tw_timeout_ms(&p->timers));
+    for (i = 0; i < n; i++) {
+      if (!(c = events[i].data.ptr)) {
+        accept_clients(p);
+      } else if (events[i].data.ptr == &p->queue) {
+        take_clients(p);
+      } else if (c->fd >= 0) {
+        // errors and hangups surface as a failed read or write
+        handle_client(
+            c, (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0,
+            (events[i].events & EPOLLOUT) != 0);
       }
     }
+
+    // close connections that missed a deadline
+    tw_advance(&p->timers);
+    check_dump();
   }
 }
 
-int main(int argc, char **argv) {
-  int listen_fd, conn_fd;
-  socklen_t client_len;
-  struct sockaddr_storage client_addr;
-  static pool pool;
+static void *reactor_thread(void *vargp) {
+  pool *p = vargp;
 
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-    exit(0);
+  if (p->epoll_fd >= 0) {
+    epoll_loop(p);
+  } else {
+    select_loop(p);
   }
+  return NULL;
+}
 
-  listen_fd = open_listenfd(argv[1]);
-  init_pool(listen_fd, &pool);
+/**
+ * hand each new connection to the next reactor round-robin, skipping any
+ * whose queue is full
+ */
+static void acceptor_loop(int listen_fd, pool *pools, int n_reactors) {
+  int conn_fd, i, next = 0;
 
   while (1) {
-    // wait for listening/connected descriptors to become ready
-    pool.ready_set = pool.read_set;
-    pool.n_ready = select(pool.max_fd + 1, &pool.ready_set, NULL, NULL, NULL);
+    if ((conn_fd = accept_client(listen_fd)) < 0) {
+      check_dump();
+      continue;
+    }
+    for (i = 0; i < n_reactors; i++) {
+      if (handoff_push(&pools[(next + i) % n_reactors], conn_fd) == 0) {
+        break;
+      }
+    }
+    if (i == n_reactors) {
+      alog(ALOG_ERROR, "event=reject fd=%d reason=handoff_full", conn_fd);
+      close(conn_fd);
+    }
+    next = (next + i + 1) % n_reactors;
+  }
+}
+
+static void usage(char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-e] [-n reactors] [-v off|error|info|debug] "
+          "[-i idle_ms] [-t line_ms] [-w write_ms] <port>\n",
+          prog);
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  int listen_fd, opt, i, use_epoll = 0, n_reactors = 1;
+  int log_level = ALOG_INFO;
+  struct sigaction sa;
+  pool *pools;
 
-    // if listening descriptor is ready, add new client to pool
-    if (FD_ISSET(listen_fd, &pool.ready_set)) {
-      client_len = sizeof(struct sockaddr_storage);
-      conn_fd = accept(listen_fd, (SA *)&client_addr, &client_len);
-      add_client(conn_fd, &pool);
+  while ((opt = getopt(argc, argv, "en:v:i:t:w:")) != -1) {
+    switch (opt) {
+    case 'e': // epoll instead of select: no FD_SETSIZE cap, O(ready) wakeups
+      use_epoll = 1;
+      break;
+    case 'n': // event loop threads, fed by a separate acceptor thread
+      n_reactors = atoi(optarg);
+      if (n_reactors < 1 || n_reactors > MAX_REACTORS) {
+        usage(argv[0]);
+      }
+      break;
+    case 'v':
+      if ((log_level = alog_parse_level(optarg)) < 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 'i': // close connections idle this long between lines
+      timeout_ms[TIMEOUT_IDLE] = atoi(optarg);
+      break;
+    case 't': // ... or this long after a line started
+      timeout_ms[TIMEOUT_LINE] = atoi(optarg);
+      break;
+    case 'w': // ... or not reading their echo for this long
+      timeout_ms[TIMEOUT_WRITE] = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
     }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+
+  // a client closing with echo in flight shows up as EPIPE
+  signal(SIGPIPE, SIG_IGN);
+
+  // kill -USR1 dumps the metrics; no SA_RESTART, so a blocked accept or
+  // wait returns and notices
+  sa.sa_handler = request_dump;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;
+  sigaction(SIGUSR1, &sa, NULL);
+
+  alog_init(log_level, STDOUT_FILENO);
+  sock_reserve_spare();
+  if ((listen_fd = open_listenfd(argv[optind])) < 0) {
+    app_error("open_listenfd error");
+  }
+  pools = aligned_alloc(64, n_reactors * sizeof(pool));
+  for (i = 0; i < n_reactors; i++) {
+    pools[i].id = i;
+    init_pool(listen_fd, use_epoll, n_reactors, &pools[i]);
+  }
+
+  if (n_reactors == 1) {
+    // a single reactor accepts for itself, in batches until EAGAIN
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    reactor_thread(&pools[0]);
+  }
 
-    // echo a text line from each ready connected descriptor
-    check_clients(&pool);
+  // otherwise this thread only accepts, blocking, and hands off
+  for (i = 0; i < n_reactors; i++) {
+    pthread_create(&pools[i].tid, NULL, reactor_thread, &pools[i]);
   }
+  acceptor_loop(listen_fd, pools, n_reactors);
 }
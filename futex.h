@@ -0,0 +1,30 @@
+#ifndef INCLUDED_FUTEX_H
+#define INCLUDED_FUTEX_H
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Process-private futex and spin helpers shared by the lock-free queues.
+ * A waiter reads the word, rechecks its condition, then sleeps only while
+ * the word still holds what it read; a waker changes the word first.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+static inline void futex_wait(atomic_uint *addr, unsigned seen) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static inline void futex_wake(atomic_uint *addr, int n) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+#endif
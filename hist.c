@@ -0,0 +1,111 @@
+/**
+ * Log-linear histograms for latency distributions
+ */
+#include "hist.h"
+#include <string.h>
+
+/**
+ * bucket holding `v`
+ */
+static int bucket_of(uint64_t v) {
+  int shift;
+
+  if (v < HIST_SUB) {
+    return v;
+  }
+  // keep the HIST_SUB_BITS + 1 most significant bits
+  shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+}
+
+/**
+ * largest value that lands in bucket `i`
+ */
+static uint64_t bucket_top(int i) {
+  int shift;
+
+  if (i < HIST_SUB) {
+    return i;
+  }
+  shift = i / HIST_SUB - 1;
+  return (((uint64_t)(i % HIST_SUB + HIST_SUB) + 1) << shift) - 1;
+}
+
+void hist_init(hist *h) {
+  memset(h, 0, sizeof(hist));
+  h->min = UINT64_MAX;
+}
+
+void hist_record(hist *h, uint64_t v) {
+  h->buckets[bucket_of(v)]++;
+  h->count++;
+  h->sum += v;
+  if (v < h->min) {
+    h->min = v;
+  }
+  if (v > h->max) {
+    h->max = v;
+  }
+}
+
+/**
+ * record `v` plus the samples a stalled loop failed to take
+ */
+void hist_record_corrected(hist *h, uint64_t v, uint64_t interval) {
+  uint64_t missing;
+
+  hist_record(h, v);
+  if (interval == 0) {
+    return;
+  }
+  for (missing = v - (v >= interval ? interval : v); missing >= interval;
+       missing -= interval) {
+    hist_record(h, missing);
+  }
+}
+
+/**
+ * add every sample of `src` to `dst`
+ */
+void hist_merge(hist *dst, const hist *src) {
+  int i;
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+/**
+ * smallest value that at least `p` percent of samples are at or below
+ */
+uint64_t hist_percentile(const hist *h, double p) {
+  uint64_t rank, seen = 0;
+  int i;
+
+  if (h->count == 0) {
+    return 0;
+  }
+  rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    if ((seen += h->buckets[i]) >= rank) {
+      // never report beyond what was actually seen
+      return bucket_top(i) < h->max ? bucket_top(i) : h->max;
+    }
+  }
+  return h->max;
+}
+
+double hist_mean(const hist *h) {
+  return h->count ? (double)h->sum / h->count : 0.0;
+}
@@ -0,0 +1,47 @@
+#ifndef INCLUDED_HIST_H
+#define INCLUDED_HIST_H
+
+#include <stdint.h>
+
+/**
+ * Log-linear histogram: values below HIST_SUB are exact, larger ones fall in
+ * one of HIST_SUB linear sub-buckets per power of two, so any recorded value
+ * is reported within 1/HIST_SUB (~3%) of itself.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+  uint64_t count; // values recorded
+  uint64_t sum;   // of all values, for the mean
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+} hist;
+
+void hist_init(hist *h);
+
+void hist_record(hist *h, uint64_t v);
+
+/**
+ * record `v` and, when it exceeds `interval` (the expected time between
+ * samples), the samples a stalled measurement loop failed to take:
+ * v - interval, v - 2 * interval, ... This corrects coordinated omission.
+ */
+void hist_record_corrected(hist *h, uint64_t v, uint64_t interval);
+
+/**
+ * add every sample of `src` to `dst`
+ */
+void hist_merge(hist *dst, const hist *src);
+
+/**
+ * smallest value that at least `p` percent of samples are at or below,
+ * reported as the top of its bucket
+ */
+uint64_t hist_percentile(const hist *h, double p);
+
+double hist_mean(const hist *h);
+
+#endif
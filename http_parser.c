@@ -0,0 +1,255 @@
+/**
+ * A single-pass, zero-copy HTTP request parser
+ */
+#include "http_parser.h"
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MIME_EXT_MAX 8     // longest extension in the table
+#define MIME_TABLE_SIZE 64 // open-addressed, power of two, mostly empty
+
+const char *const http_mime_types[HTTP_MIME_COUNT] = {
+    [HTTP_MIME_TEXT] = "text/plain",
+    [HTTP_MIME_HTML] = "text/html",
+    [HTTP_MIME_GIF] = "image/gif",
+    [HTTP_MIME_PNG] = "image/png",
+    [HTTP_MIME_JPEG] = "image/jpeg",
+    [HTTP_MIME_CSS] = "text/css",
+    [HTTP_MIME_JS] = "application/javascript",
+    [HTTP_MIME_JSON] = "application/json",
+    [HTTP_MIME_SVG] = "image/svg+xml",
+    [HTTP_MIME_ICON] = "image/x-icon",
+    [HTTP_MIME_PDF] = "application/pdf",
+    [HTTP_MIME_WASM] = "application/wasm",
+    [HTTP_MIME_WOFF2] = "font/woff2",
+    [HTTP_MIME_MP4] = "video/mp4",
+    [HTTP_MIME_XML] = "application/xml",
+};
+
+static const struct {
+  const char *ext;
+  int type;
+} mime_exts[] = {
+    {"html", HTTP_MIME_HTML}, {"htm", HTTP_MIME_HTML},
+    {"gif", HTTP_MIME_GIF},   {"png", HTTP_MIME_PNG},
+    {"jpg", HTTP_MIME_JPEG},  {"jpeg", HTTP_MIME_JPEG},
+    {"css", HTTP_MIME_CSS},   {"js", HTTP_MIME_JS},
+    {"json", HTTP_MIME_JSON}, {"svg", HTTP_MIME_SVG},
+    {"ico", HTTP_MIME_ICON},  {"pdf", HTTP_MIME_PDF},
+    {"wasm", HTTP_MIME_WASM}, {"woff2", HTTP_MIME_WOFF2},
+    {"mp4", HTTP_MIME_MP4},   {"xml", HTTP_MIME_XML},
+    {"txt", HTTP_MIME_TEXT},
+};
+
+static struct {
+  char ext[MIME_EXT_MAX]; // lower case, not NUL-terminated
+  unsigned char len;      // 0 marks an empty bucket
+  unsigned char type;
+} mime_table[MIME_TABLE_SIZE];
+static pthread_once_t mime_once = PTHREAD_ONCE_INIT;
+
+/**
+ * scan_delims - first occurrence of `a` or `b` in [p, end), or `end`.
+ * Compares 16 bytes at a time where SSE2 is available.
+ */
+static const char *scan_delims(const char *p, const char *end, char a,
+                               char b) {
+#ifdef __SSE2__
+  __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), v;
+  int mask;
+
+  while (end - p >= 16) {
+    v = _mm_loadu_si128((const __m128i *)p);
+    mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == a || *p == b) {
+      return p;
+    }
+  }
+  return end;
+}
+
+/**
+ * parse the request line and headers in `buf` in a single pass, without
+ * copying. Returns the length of the request head when it is complete, 0 if
+ * more input is needed, -1 if it is malformed.
+ */
+int http_parse_request(const char *buf, size_t len, http_request *req) {
+  const char *p = buf, *end = buf + len, *q, *eol, *v, *ve;
+
+  // tolerate blank lines ahead of the request line
+  while (p < end && (*p == '\r' || *p == '\n')) {
+    p++;
+  }
+
+  // request line: method SP uri SP version EOL
+  if ((q = scan_delims(p, end, ' ', '\n')) == end) {
+    return 0;
+  }
+  if (*q != ' ' || q == p) {
+    return -1;
+  }
+  req->method.p = p;
+  req->method.len = q - p;
+
+  p = q + 1;
+  if ((q = scan_delims(p, end, ' ', '\n')) == end) {
+    return 0;
+  }
+  if (*q != ' ' || q == p) {
+    return -1;
+  }
+  req->uri.p = p;
+  req->uri.len = q - p;
+
+  p = q + 1;
+  if (!(eol = memchr(p, '\n', end - p))) {
+    return 0;
+  }
+  ve = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+  if (ve == p) {
+    return -1;
+  }
+  req->version.p = p;
+  req->version.len = ve - p;
+
+  // headers: name ':' OWS value OWS EOL, up to an empty line
+  req->n_headers = 0;
+  for (p = eol + 1;; p = eol + 1) {
+    if (p == end) {
+      return 0;
+    }
+    if (*p == '\n') {
+      return p + 1 - buf;
+    }
+    if (*p == '\r') {
+      if (p + 1 == end) {
+        return 0;
+      }
+      return (p[1] == '\n') ? p + 2 - buf : -1;
+    }
+
+    if ((q = scan_delims(p, end, ':', '\n')) == end) {
+      return 0;
+    }
+    if (*q == '\n' || q == p) { /* no colon, or an empty name */
+      return -1;
+    }
+    if (!(eol = memchr(q + 1, '\n', end - q - 1))) {
+      return 0;
+    }
+
+    v = q + 1;
+    ve = eol;
+    while (v < ve && (*v == ' ' || *v == '\t')) {
+      v++;
+    }
+    while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ' || ve[-1] == '\t')) {
+      ve--;
+    }
+    if (req->n_headers < HTTP_MAX_HEADERS) {
+      req->headers[req->n_headers].name.p = p;
+      req->headers[req->n_headers].name.len = q - p;
+      req->headers[req->n_headers].value.p = v;
+      req->headers[req->n_headers].value.len = ve - v;
+      req->n_headers++;
+    }
+  }
+}
+
+/**
+ * does `s` equal the string `lit`, ignoring case?
+ */
+int slice_caseeq(slice s, const char *lit) {
+  return strlen(lit) == s.len && !strncasecmp(s.p, lit, s.len);
+}
+
+/**
+ * value of header `name` (case-insensitive), or NULL if absent
+ */
+const slice *http_find_header(const http_request *req, const char *name) {
+  int i;
+
+  for (i = 0; i < req->n_headers; i++) {
+    if (slice_caseeq(req->headers[i].name, name)) {
+      return &req->headers[i].value;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * FNV-1a over the lower-cased extension
+ */
+static unsigned mime_hash(const char *ext, size_t len) {
+  unsigned h = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)(ext[i] | 0x20)) * 16777619u;
+  }
+  return h;
+}
+
+/**
+ * fill the extension hash table, once
+ */
+static void mime_build(void) {
+  unsigned i, h;
+  size_t len;
+
+  for (i = 0; i < sizeof(mime_exts) / sizeof(mime_exts[0]); i++) {
+    len = strlen(mime_exts[i].ext);
+    h = mime_hash(mime_exts[i].ext, len);
+    while (mime_table[h & (MIME_TABLE_SIZE - 1)].len) { /* linear probing */
+      h++;
+    }
+    h &= MIME_TABLE_SIZE - 1;
+    memcpy(mime_table[h].ext, mime_exts[i].ext, len);
+    mime_table[h].len = len;
+    mime_table[h].type = mime_exts[i].type;
+  }
+}
+
+/**
+ * MIME type index for the extension of `path`, HTTP_MIME_TEXT if unknown
+ */
+int http_mime_lookup(const char *path, size_t len) {
+  const char *end = path + len, *ext = end;
+  unsigned h;
+  size_t ext_len;
+
+  // the extension is whatever follows the last '.' of the last segment
+  while (ext > path && ext[-1] != '.' && ext[-1] != '/') {
+    ext--;
+  }
+  if (ext == path || ext[-1] != '.') {
+    return HTTP_MIME_TEXT;
+  }
+  if ((ext_len = end - ext) == 0 || ext_len > MIME_EXT_MAX) {
+    return HTTP_MIME_TEXT;
+  }
+
+  pthread_once(&mime_once, mime_build);
+  for (h = mime_hash(ext, ext_len);; h++) {
+    h &= MIME_TABLE_SIZE - 1;
+    if (!mime_table[h].len) {
+      return HTTP_MIME_TEXT;
+    }
+    if (mime_table[h].len == ext_len &&
+        !strncasecmp(mime_table[h].ext, ext, ext_len)) {
+      return mime_table[h].type;
+    }
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef INCLUDED_HTTP_PARSER_H
+#define INCLUDED_HTTP_PARSER_H
+
+#include <stddef.h>
+
+#define HTTP_MAX_HEADERS 32 // headers kept per request; extras are skipped
+
+/**
+ * a view into the caller's buffer; not NUL-terminated
+ */
+typedef struct {
+  const char *p;
+  size_t len;
+} slice;
+
+typedef struct {
+  slice name;
+  slice value; // leading and trailing blanks trimmed
+} http_header;
+
+typedef struct {
+  slice method;
+  slice uri;
+  slice version;
+  int n_headers;
+  http_header headers[HTTP_MAX_HEADERS];
+} http_request;
+
+/**
+ * MIME types tiny knows; the index is what http_mime_lookup returns
+ */
+enum {
+  HTTP_MIME_TEXT, // default for unknown extensions
+  HTTP_MIME_HTML,
+  HTTP_MIME_GIF,
+  HTTP_MIME_PNG,
+  HTTP_MIME_JPEG,
+  HTTP_MIME_CSS,
+  HTTP_MIME_JS,
+  HTTP_MIME_JSON,
+  HTTP_MIME_SVG,
+  HTTP_MIME_ICON,
+  HTTP_MIME_PDF,
+  HTTP_MIME_WASM,
+  HTTP_MIME_WOFF2,
+  HTTP_MIME_MP4,
+  HTTP_MIME_XML,
+  HTTP_MIME_COUNT
+};
+
+extern const char *const http_mime_types[HTTP_MIME_COUNT];
+
+/**
+ * parse the request line and headers in `buf` in a single pass, without
+ * copying. Returns the length of the request head (through the blank line)
+ * when it is complete, 0 if more input is needed, -1 if it is malformed.
+ * Bare LF line endings are accepted as well as CRLF.
+ */
+int http_parse_request(const char *buf, size_t len, http_request *req);
+
+/**
+ * value of header `name` (case-insensitive), or NULL if absent
+ */
+const slice *http_find_header(const http_request *req, const char *name);
+
+/**
+ * does `s` equal the string `lit`, ignoring case?
+ */
+int slice_caseeq(slice s, const char *lit);
+
+/**
+ * MIME type index for the extension of `path`, HTTP_MIME_TEXT if unknown
+ */
+int http_mime_lookup(const char *path, size_t len);
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * http_parser_bench.c - compare tiny's old sscanf/strstr request handling
+ * with the single-pass parser
+ *
+ *   gcc -O2 -pthread -o http_parser_bench http_parser_bench.c http_parser.c
+ *   ./http_parser_bench [iterations]
+ */
+#include "http_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define MAXLINE 8192
+
+static const char request[] =
+    "GET /assets/css/site.min.css?v=20261019 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 "
+    "Firefox/131.0\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: https://www.example.com/blog/2026/10/some-long-article-name\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=6f1c9b0e2d8a4f3b9c7e5a1d0b2c4e6f; theme=dark; "
+    "consent=1\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-Modified-Since: Sat, 17 Oct 2026 09:12:44 GMT\r\n"
+    "\r\n";
+
+static const char *filenames[] = {"./index.html", "./logo.png",
+                                  "./site.min.css", "./app.js", "./README"};
+
+static volatile size_t sink; // keeps results alive
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * the old path: line-at-a-time copies, as rio_readlineb made them
+ */
+static size_t readline_mem(const char **pp, char *buf, size_t max_len) {
+  const char *p = *pp;
+  size_t n = 0;
+
+  while (n < max_len - 1 && *p) {
+    if ((buf[n++] = *p++) == '\n') {
+      break;
+    }
+  }
+  buf[n] = '\0';
+  *pp = p;
+  return n;
+}
+
+static const char *legacy_filetype(const char *filename) {
+  if (strstr(filename, ".html")) {
+    return "text/html";
+  } else if (strstr(filename, ".gif")) {
+    return "image/gif";
+  } else if (strstr(filename, ".png")) {
+    return "image/png";
+  } else if (strstr(filename, ".jpg")) {
+    return "image/jpeg";
+  } else {
+    return "text/plain";
+  }
+}
+
+static void legacy_parse(const char *req, int i) {
+  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char accept_encoding[MAXLINE], *value;
+  const char *p = req;
+
+  readline_mem(&p, buf, MAXLINE);
+  sscanf(buf, "%s %s %s", method, uri, version);
+  sink += strcasecmp(method, "GET");
+  while (readline_mem(&p, buf, MAXLINE) > 0 && strcmp(buf, "\r\n")) {
+    if ((value = index(buf, ':'))) {
+      *value++ = '\0';
+      if (!strcasecmp(buf, "Accept-Encoding")) {
+        strcpy(accept_encoding, value);
+      }
+    }
+  }
+  sink += (size_t)legacy_filetype(filenames[i % 5]);
+}
+
+static void fast_parse(const char *req, size_t len, int i) {
+  http_request r;
+  const char *f = filenames[i % 5];
+
+  sink += http_parse_request(req, len, &r);
+  sink += slice_caseeq(r.method, "GET");
+  sink += (size_t)http_find_header(&r, "Accept-Encoding");
+  sink += http_mime_lookup(f, strlen(f));
+}
+
+int main(int argc, char **argv) {
+  int i, iters = argc > 1 ? atoi(argv[1]) : 1000000;
+  size_t len = strlen(request);
+  double t, legacy, fast;
+
+  t = now_sec();
+  for (i = 0; i < iters; i++) {
+    legacy_parse(request, i);
+  }
+  legacy = now_sec() - t;
+
+  t = now_sec();
+  for (i = 0; i < iters; i++) {
+    fast_parse(request, len, i);
+  }
+  fast = now_sec() - t;
+
+  printf("request head: %zu bytes, %d iterations\n", len, iters);
+  printf("%-10s %10.1f ns/req %10.1f MB/s\n", "legacy", legacy / iters * 1e9,
+         len * (double)iters / legacy / 1e6);
+  printf("%-10s %10.1f ns/req %10.1f MB/s\n", "parser", fast / iters * 1e9,
+         len * (double)iters / fast / 1e6);
+  printf("speedup    %10.2fx\n", legacy / fast);
+  return 0;
+}
@@ -0,0 +1,239 @@
+/**
+ * Building and sending HTTP responses with few copies and few syscalls
+ */
+#include "http_response.h"
+#include "http_parser.h"
+#include "rio.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define STATUS(code, reason)                                                   \
+  {code, "HTTP/1.0 " #code " " reason "\r\nServer: Tiny Web Server\r\n"}
+
+/**
+ * status lines, preformatted together with the Server header
+ */
+static const struct {
+  int code;
+  const char *line;
+} statuses[] = {
+    STATUS(200, "OK"),
+    STATUS(400, "Bad Request"),
+    STATUS(403, "Forbidden"),
+    STATUS(404, "Not Found"),
+    STATUS(408, "Request Timeout"),
+    STATUS(414, "URI Too Long"),
+    STATUS(500, "Internal Server Error"),
+    STATUS(501, "Not Implemented"),
+    STATUS(503, "Service Unavailable"),
+};
+
+#define N_STATUSES (sizeof(statuses) / sizeof(statuses[0]))
+
+static size_t status_lens[N_STATUSES];
+static char type_lines[HTTP_MIME_COUNT][64]; // "Content-type: ...\r\n"
+static size_t type_lens[HTTP_MIME_COUNT];
+static pthread_once_t lines_once = PTHREAD_ONCE_INIT;
+
+static __thread time_t date_sec;  // second the cached Date line is for
+static __thread char date_line[64]; // "Date: ...\r\n"
+static __thread size_t date_len;
+
+/**
+ * format the per-status and per-type lines, once
+ */
+static void build_lines(void) {
+  size_t i;
+
+  for (i = 0; i < N_STATUSES; i++) {
+    status_lens[i] = strlen(statuses[i].line);
+  }
+  for (i = 0; i < HTTP_MIME_COUNT; i++) {
+    type_lens[i] = snprintf(type_lines[i], sizeof(type_lines[i]),
+                            "Content-type: %s\r\n", http_mime_types[i]);
+  }
+}
+
+static int status_index(int status) {
+  size_t i;
+
+  for (i = 0; i < N_STATUSES; i++) {
+    if (statuses[i].code == status) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * append `len` raw bytes of header text
+ */
+void http_resp_append(http_resp *rp, const char *s, size_t len) {
+  // keep room for the blank line that ends the headers
+  if (rp->len + len + 2 > HTTP_RESP_HDR_MAX) {
+    rp->truncated = 1;
+    return;
+  }
+  memcpy(rp->buf + rp->len, s, len);
+  rp->len += len;
+}
+
+/**
+ * begin a response: preformatted status line, Server and a cached Date
+ */
+void http_resp_start(http_resp *rp, int status) {
+  time_t now = time(NULL);
+  struct tm tm;
+  char line[64];
+  int i;
+
+  pthread_once(&lines_once, build_lines);
+  rp->len = 0;
+  rp->truncated = 0;
+  if ((i = status_index(status)) >= 0) {
+    http_resp_append(rp, statuses[i].line, status_lens[i]);
+  } else {
+    http_resp_append(rp, line,
+                     snprintf(line, sizeof(line),
+                              "HTTP/1.0 %d Unknown\r\nServer: Tiny Web "
+                              "Server\r\n",
+                              status));
+  }
+
+  // the Date line only changes once a second
+  if (now != date_sec) {
+    gmtime_r(&now, &tm);
+    date_len = strftime(date_line, sizeof(date_line),
+                        "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    date_sec = now;
+  }
+  http_resp_append(rp, date_line, date_len);
+}
+
+/**
+ * append "name: value\r\n"
+ */
+void http_resp_header(http_resp *rp, const char *name, const char *value) {
+  http_resp_append(rp, name, strlen(name));
+  http_resp_lit(rp, ": ");
+  http_resp_append(rp, value, strlen(value));
+  http_resp_lit(rp, "\r\n");
+}
+
+/**
+ * append the preformatted Content-type line for a MIME index
+ */
+void http_resp_content_type(http_resp *rp, int mime) {
+  pthread_once(&lines_once, build_lines);
+  if (mime < 0 || mime >= HTTP_MIME_COUNT) {
+    mime = HTTP_MIME_TEXT;
+  }
+  http_resp_append(rp, type_lines[mime], type_lens[mime]);
+}
+
+/**
+ * append Content-length without going through printf
+ */
+void http_resp_content_length(http_resp *rp, size_t len) {
+  char digits[24], *p = digits + sizeof(digits);
+
+  // digits are produced least significant first
+  *--p = '\n';
+  *--p = '\r';
+  do {
+    *--p = '0' + len % 10;
+    len /= 10;
+  } while (len);
+  http_resp_lit(rp, "Content-length: ");
+  http_resp_append(rp, p, digits + sizeof(digits) - p);
+}
+
+/**
+ * terminate the header block, whose space is always reserved; -1 with
+ * EMSGSIZE if a header was dropped, since the response would be wrong
+ */
+static int finish_headers(http_resp *rp) {
+  if (rp->truncated) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  rp->buf[rp->len++] = '\r';
+  rp->buf[rp->len++] = '\n';
+  return 0;
+}
+
+/**
+ * send headers, the blank line and `body` in a single writev
+ */
+ssize_t http_resp_send(int fd, http_resp *rp, const void *body, size_t len) {
+  struct iovec iov[2];
+
+  if (finish_headers(rp) < 0) {
+    return -1;
+  }
+  iov[0].iov_base = rp->buf;
+  iov[0].iov_len = rp->len;
+  iov[1].iov_base = (void *)body;
+  iov[1].iov_len = len;
+  return rio_writevn(fd, iov, len > 0 ? 2 : 1);
+}
+
+/**
+ * send the headers so far but leave the block open, for a CGI program to
+ * finish
+ */
+ssize_t http_resp_send_head(int fd, http_resp *rp) {
+  if (rp->truncated) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return rio_writen(fd, rp->buf, rp->len);
+}
+
+/**
+ * send headers, the blank line and `len` bytes of `src_fd`, corking the
+ * headers so they go out with the first part of the file
+ */
+ssize_t http_resp_sendfile(int fd, http_resp *rp, int src_fd, size_t len) {
+  size_t n_left = len, sent = 0;
+  ssize_t n;
+  off_t offset = 0;
+
+  if (finish_headers(rp) < 0) {
+    return -1;
+  }
+  while (sent < rp->len) {
+    // MSG_MORE holds the partial segment back until the file data follows
+    if ((n = send(fd, rp->buf + sent, rp->len - sent,
+                  (len > 0 ? MSG_MORE : 0) | MSG_NOSIGNAL)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != ENOTSOCK) {
+        return -1;
+      }
+      // not a socket: plain writes still work
+      if (rio_writen(fd, rp->buf + sent, rp->len - sent) < 0) {
+        return -1;
+      }
+      n = rp->len - sent;
+    }
+    sent += n;
+  }
+
+  while (n_left > 0) {
+    if ((n = sendfile(fd, src_fd, &offset, n_left)) <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    n_left -= n;
+  }
+  return rp->len + len;
+}
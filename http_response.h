@@ -0,0 +1,68 @@
+#ifndef INCLUDED_HTTP_RESPONSE_H
+#define INCLUDED_HTTP_RESPONSE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define HTTP_RESP_HDR_MAX 1024 // room for the status line and headers
+
+/**
+ * response headers under construction; sent along with the body
+ */
+typedef struct {
+  size_t len;                  // bytes used in buf
+  int truncated;               // a header did not fit: sending fails
+  char buf[HTTP_RESP_HDR_MAX]; // status line and headers
+} http_resp;
+
+/**
+ * append a string literal header, e.g. "Connection: close\r\n"
+ */
+#define http_resp_lit(rp, s) http_resp_append((rp), (s), sizeof(s) - 1)
+
+/**
+ * begin a response: preformatted status line, Server and a cached Date
+ */
+void http_resp_start(http_resp *rp, int status);
+
+/**
+ * append `len` raw bytes of header text
+ */
+void http_resp_append(http_resp *rp, const char *s, size_t len);
+
+/**
+ * append "name: value\r\n"
+ */
+void http_resp_header(http_resp *rp, const char *name, const char *value);
+
+/**
+ * append the preformatted Content-type line for a MIME index from
+ * http_mime_lookup
+ */
+void http_resp_content_type(http_resp *rp, int mime);
+
+/**
+ * append Content-length without going through printf
+ */
+void http_resp_content_length(http_resp *rp, size_t len);
+
+/**
+ * send headers, the blank line and `body` in a single writev. Like the other
+ * senders, fails with EMSGSIZE without sending anything if a header was
+ * dropped.
+ */
+ssize_t http_resp_send(int fd, http_resp *rp, const void *body, size_t len);
+
+/**
+ * send the headers so far but leave the block open, for a CGI program to
+ * finish
+ */
+ssize_t http_resp_send_head(int fd, http_resp *rp);
+
+/**
+ * send headers, the blank line and `len` bytes of `src_fd`. The headers are
+ * corked (MSG_MORE) so they share a segment with the start of the sendfile.
+ */
+ssize_t http_resp_sendfile(int fd, http_resp *rp, int src_fd, size_t len);
+
+#endif
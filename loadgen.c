@@ -0,0 +1,393 @@
+/**
+ * loadgen.c - load generator and latency benchmark for tiny and echo_server
+ *
+ *   gcc -O2 -pthread -o loadgen loadgen.c sock.c rio.c hist.c
+ *   ./loadgen -c 16 -d 10 -u /home.html:9 -u '/cgi-bin/adder?1&2:1' host 8000
+ *   ./loadgen -c 16 -R 20000 -e host 8001
+ *
+ * Each connection runs in its own thread. In closed-loop mode a connection
+ * sends its next request as soon as the previous one completes; with -R the
+ * connections share a fixed arrival rate (open loop) and latency is measured
+ * from when each request was due, not from when it was finally sent, so a
+ * stalled server cannot hide its queueing delay (coordinated omission).
+ */
+#define _GNU_SOURCE
+#include "hist.h"
+#include "rio.h"
+#include "sock.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_URLS 64
+#define NS_PER_SEC 1000000000ULL
+#define SPIN_NS 20000ULL /* how early sleep_until wakes to spin */
+
+typedef struct {
+  char path[MAXLINE];
+  int weight; // relative share of requests
+} url;
+
+/**
+ * per-connection state and results; merged once the run is over
+ */
+typedef struct {
+  pthread_t tid;
+  int id;             // 0 .. conns - 1
+  unsigned seed;      // for picking URLs
+  uint64_t requests;  // completed requests
+  uint64_t missed;    // fell due in open loop but were never sent
+  uint64_t bad;       // completed with a 4xx/5xx status
+  uint64_t errors;    // connect, I/O or protocol failures
+  uint64_t connects;  // connections opened
+  uint64_t bytes;     // response bytes read
+  hist latency;       // corrected for coordinated omission
+  hist service;       // raw send-to-response time
+} worker;
+
+static struct {
+  char *host;
+  char *port;
+  int conns;      // concurrent connections
+  int duration;   // seconds
+  double rate;    // total requests/s, 0 for closed loop
+  int keep_alive; // reuse connections when the server allows it
+  int echo;       // speak the echo protocol instead of HTTP
+  int msg_len;    // echo line length, newline included
+} cfg = {NULL, NULL, 1, 10, 0, 0, 0, 64};
+
+static url urls[MAX_URLS];
+static int n_urls, total_weight;
+static char echo_msg[MAXLINE];
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * sleep until just before `t`, then spin the rest: a sleep wakes late by
+ * the scheduler's latency, and that delay would count against the server
+ */
+static void sleep_until(uint64_t t) {
+  struct timespec ts;
+
+  if (t > now_ns() + SPIN_NS) {
+    ts.tv_sec = (t - SPIN_NS) / NS_PER_SEC;
+    ts.tv_nsec = (t - SPIN_NS) % NS_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+    }
+  }
+  while (now_ns() < t) {
+  }
+}
+
+/**
+ * add "path[:weight]" to the URL mix
+ */
+static int add_url(char *spec) {
+  char *colon = strrchr(spec, ':');
+  int weight = 1;
+
+  if (n_urls == MAX_URLS) {
+    return -1;
+  }
+  if (colon && colon[1] && strspn(colon + 1, "0123456789") ==
+                               strlen(colon + 1)) {
+    weight = atoi(colon + 1);
+    *colon = '\0';
+  }
+  if (weight <= 0 || strlen(spec) >= MAXLINE) {
+    return -1;
+  }
+  strcpy(urls[n_urls].path, spec);
+  urls[n_urls++].weight = weight;
+  total_weight += weight;
+  return 0;
+}
+
+static url *pick_url(worker *w) {
+  int i, r = rand_r(&w->seed) % total_weight;
+
+  for (i = 0; r >= urls[i].weight; i++) {
+    r -= urls[i].weight;
+  }
+  return &urls[i];
+}
+
+/**
+ * one HTTP exchange. Returns the status code, or -1 if the connection
+ * failed. `*keep` says whether the connection can be reused.
+ */
+static int do_http(int fd, rio_t *rp, worker *w, int *keep) {
+  char buf[MAXLINE];
+  long len = -1, chunk;
+  int n, status, minor;
+
+  n = snprintf(buf, MAXLINE,
+               "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+               pick_url(w)->path, cfg.host,
+               cfg.keep_alive ? "keep-alive" : "close");
+  if (rio_writen(fd, buf, n) < 0) {
+    return -1;
+  }
+
+  // status line, then headers up to the blank line
+  if (rio_readlineb(rp, buf, MAXLINE) <= 0 ||
+      sscanf(buf, "HTTP/1.%d %d", &minor, &status) != 2) {
+    return -1;
+  }
+  w->bytes += strlen(buf);
+  *keep = cfg.keep_alive && minor > 0;
+  while ((n = rio_readlineb(rp, buf, MAXLINE)) > 0 && strcmp(buf, "\r\n")) {
+    w->bytes += n;
+    if (!strncasecmp(buf, "Content-length:", 15)) {
+      len = atol(buf + 15);
+    } else if (!strncasecmp(buf, "Connection:", 11)) {
+      *keep = cfg.keep_alive && !strcasestr(buf + 11, "close");
+    }
+  }
+  if (n <= 0) {
+    return -1;
+  }
+
+  // body: by length, or up to EOF when the server gives none
+  if (len < 0) {
+    *keep = 0;
+    while ((n = rio_readnb(rp, buf, MAXLINE)) > 0) {
+      w->bytes += n;
+    }
+    return n < 0 ? -1 : status;
+  }
+  for (; len > 0; len -= chunk) {
+    chunk = len < MAXLINE ? len : MAXLINE;
+    if (rio_readnb(rp, buf, chunk) != chunk) {
+      return -1;
+    }
+    w->bytes += chunk;
+  }
+  return status;
+}
+
+/**
+ * one echo round trip. Returns 200 on success, -1 on failure.
+ */
+static int do_echo(int fd, rio_t *rp, worker *w, int *keep) {
+  char buf[MAXLINE];
+  int n;
+
+  *keep = 1;
+  if (rio_writen(fd, echo_msg, cfg.msg_len) < 0 ||
+      (n = rio_readlineb(rp, buf, MAXLINE)) != cfg.msg_len) {
+    return -1;
+  }
+  w->bytes += n;
+  return 200;
+}
+
+static void *worker_thread(void *vargp) {
+  worker *w = vargp;
+  uint64_t start = now_ns(), end = start + cfg.duration * NS_PER_SEC;
+  uint64_t interval = 0, due = start, sent, done;
+  int fd = -1, keep = 0, status;
+  rio_t rio;
+
+  // open loop: this connection's share of the arrival rate, staggered
+  // against the others so together they arrive evenly, not in bursts
+  if (cfg.rate > 0) {
+    interval = (uint64_t)(NS_PER_SEC * cfg.conns / cfg.rate);
+    // wake from sleeps on time: no default 50us of timer slack
+    prctl(PR_SET_TIMERSLACK, 1);
+    due += w->id * interval / cfg.conns;
+  }
+
+  for (; due < end; due += interval) {
+    if (interval) {
+      sleep_until(due);
+    }
+    sent = now_ns();
+    if (!interval) {
+      due = sent;
+    }
+    if (sent >= end) {
+      break;
+    }
+
+    if (fd < 0) {
+      if ((fd = open_clientfd(cfg.host, cfg.port)) < 0) {
+        w->errors++;
+        if (!interval) { /* don't spin on a server that is down */
+          sleep_until(now_ns() + NS_PER_SEC / 1000);
+        }
+        continue;
+      }
+      rio_readinitb(&rio, fd);
+      w->connects++;
+    }
+
+    status = cfg.echo ? do_echo(fd, &rio, w, &keep)
+                      : do_http(fd, &rio, w, &keep);
+    done = now_ns();
+    if (status < 0) {
+      w->errors++;
+      keep = 0;
+    } else {
+      w->requests++;
+      if (status >= 400) {
+        w->bad++;
+      }
+      if (interval) {
+        hist_record(&w->latency, done - due);
+      } else {
+        // closed loop: back-fill the requests a slow response held up,
+        // taking the typical service time as the expected interval
+        hist_record_corrected(&w->latency, done - sent,
+                              (uint64_t)hist_mean(&w->service));
+      }
+      hist_record(&w->service, done - sent);
+    }
+    if (!keep) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  // requests a slow server kept us from sending waited at least this long
+  if (interval) {
+    for (done = now_ns(); due < end; due += interval) {
+      hist_record(&w->latency, done - due);
+      w->missed++;
+    }
+  }
+  return NULL;
+}
+
+static void print_hist(const char *name, const hist *h) {
+  printf("  %-10s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+         hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+         hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3,
+         h->max / 1e3, hist_mean(h) / 1e3);
+}
+
+static void usage(char *prog) {
+  fprintf(stderr,
+          "usage: %s [-c conns] [-d seconds] [-R rate] [-k] "
+          "[-u path[:weight]]... [-e [-s line_len]] <host> <port>\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int opt, i;
+  worker *workers;
+  hist latency, service;
+  uint64_t requests = 0, missed = 0, bad = 0, errors = 0, connects = 0;
+  uint64_t bytes = 0;
+  uint64_t t0;
+  double elapsed;
+
+  while ((opt = getopt(argc, argv, "c:d:R:ku:es:")) != -1) {
+    switch (opt) {
+    case 'c':
+      cfg.conns = atoi(optarg);
+      break;
+    case 'd':
+      cfg.duration = atoi(optarg);
+      break;
+    case 'R':
+      cfg.rate = atof(optarg);
+      break;
+    case 'k':
+      cfg.keep_alive = 1;
+      break;
+    case 'u':
+      if (add_url(optarg) < 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 'e':
+      cfg.echo = 1;
+      break;
+    case 's':
+      cfg.msg_len = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 2 || cfg.conns <= 0 || cfg.duration <= 0 ||
+      cfg.msg_len < 1 || cfg.msg_len >= MAXLINE) {
+    usage(argv[0]);
+  }
+  cfg.host = argv[optind];
+  cfg.port = argv[optind + 1];
+  if (n_urls == 0) {
+    add_url("/");
+  }
+  memset(echo_msg, 'x', cfg.msg_len - 1);
+  echo_msg[cfg.msg_len - 1] = '\n';
+
+  // a server closing on us mid-write shows up as EPIPE
+  signal(SIGPIPE, SIG_IGN);
+
+  workers = calloc(cfg.conns, sizeof(worker));
+  t0 = now_ns();
+  for (i = 0; i < cfg.conns; i++) {
+    workers[i].id = i;
+    workers[i].seed = i + 1;
+    hist_init(&workers[i].latency);
+    hist_init(&workers[i].service);
+    pthread_create(&workers[i].tid, NULL, worker_thread, &workers[i]);
+  }
+
+  hist_init(&latency);
+  hist_init(&service);
+  for (i = 0; i < cfg.conns; i++) {
+    pthread_join(workers[i].tid, NULL);
+    hist_merge(&latency, &workers[i].latency);
+    hist_merge(&service, &workers[i].service);
+    requests += workers[i].requests;
+    missed += workers[i].missed;
+    bad += workers[i].bad;
+    errors += workers[i].errors;
+    connects += workers[i].connects;
+    bytes += workers[i].bytes;
+  }
+  elapsed = (now_ns() - t0) / 1e9;
+
+  if (cfg.rate > 0) {
+    printf("open loop at %.0f req/s, ", cfg.rate);
+  } else {
+    printf("closed loop, ");
+  }
+  printf("%d connections, %.1f s, %s\n", cfg.conns, elapsed,
+         cfg.echo ? "echo" : cfg.keep_alive ? "http keep-alive" : "http");
+  printf("  requests   %" PRIu64 " (%.0f req/s, %.2f MB/s read)\n", requests,
+         requests / elapsed, bytes / elapsed / 1e6);
+  printf("  connects   %" PRIu64 ", errors %" PRIu64 ", 4xx/5xx %" PRIu64 "\n",
+         connects, errors, bad);
+  if (missed) {
+    printf("  missed     %" PRIu64 " due but never sent, counted in corrected\n",
+           missed);
+  }
+  printf("  latency us %9s %9s %9s %9s %9s %9s\n", "p50", "p90", "p99",
+         "p99.9", "max", "mean");
+  print_hist("corrected", &latency);
+  print_hist("service", &service);
+
+  free(workers);
+  return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * Per-thread counters and latency histograms, summed on demand
+ */
+#include "metrics.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * one thread's metrics; only the owner writes them
+ */
+typedef struct metrics_shard {
+  _Alignas(64) atomic_ulong counters[METRIC_COUNT];
+  atomic_ulong status[METRIC_STATUS_CLASSES];
+  _Alignas(64) atomic_uint seq; // odd while the owner updates latency
+  hist latency;
+  atomic_int in_use; // owned by a live thread
+  struct metrics_shard *next;
+} metrics_shard;
+
+const char *metrics_names[METRIC_COUNT] = {"connections", "requests",
+                                           "bytes_in", "bytes_out", "errors"};
+
+const char *metrics_gauge_names[METRIC_GAUGE_COUNT] = {
+    "pool_workers", "pool_busy", "queue_depth", "queue_delay_us"};
+
+static _Atomic(metrics_shard *) shards; // every shard, newest first
+static __thread metrics_shard *my_shard;
+static pthread_key_t shard_key; // its destructor frees the shard for reuse
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static atomic_llong gauges[METRIC_GAUGE_COUNT]; // rarely set: not sharded
+static atomic_uint gauges_set;
+
+/**
+ * a thread is exiting: hand its shard, totals and all, to the next new
+ * thread, so short-lived workers do not leave a shard each behind
+ */
+static void release_shard(void *vargp) {
+  metrics_shard *sp = vargp;
+
+  my_shard = NULL;
+  atomic_store_explicit(&sp->in_use, 0, memory_order_release);
+}
+
+static void make_shard_key(void) {
+  pthread_key_create(&shard_key, release_shard);
+}
+
+/**
+ * the calling thread's shard: one a thread has released if there is one,
+ * else a new one published on the list. Shards are never freed, so the
+ * totals never go backwards.
+ */
+static metrics_shard *get_shard(void) {
+  metrics_shard *sp, *old;
+  int idle;
+
+  if ((sp = my_shard)) {
+    return sp;
+  }
+  pthread_once(&shard_key_once, make_shard_key);
+  for (sp = atomic_load(&shards); sp; sp = sp->next) {
+    idle = 0;
+    if (atomic_compare_exchange_strong_explicit(&sp->in_use, &idle, 1,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+      break;
+    }
+  }
+  if (!sp) {
+    if (!(sp = aligned_alloc(64, sizeof(metrics_shard)))) {
+      return NULL;
+    }
+    memset(sp, 0, sizeof(metrics_shard));
+    hist_init(&sp->latency);
+    atomic_init(&sp->in_use, 1);
+
+    // lock-free push onto the shard list
+    old = atomic_load(&shards);
+    do {
+      sp->next = old;
+    } while (!atomic_compare_exchange_weak(&shards, &old, sp));
+  }
+  pthread_setspecific(shard_key, sp);
+  return my_shard = sp;
+}
+
+/**
+ * single writer, so a relaxed load and store is enough: no locked add
+ */
+static void bump(atomic_ulong *cp, uint64_t n) {
+  atomic_store_explicit(
+      cp, atomic_load_explicit(cp, memory_order_relaxed) + n,
+      memory_order_relaxed);
+}
+
+void metrics_add(int counter, uint64_t n) {
+  metrics_shard *sp = get_shard();
+
+  if (sp && counter >= 0 && counter < METRIC_COUNT) {
+    bump(&sp->counters[counter], n);
+  }
+}
+
+void metrics_set(int gauge, int64_t value) {
+  if (gauge >= 0 && gauge < METRIC_GAUGE_COUNT) {
+    atomic_store_explicit(&gauges[gauge], value, memory_order_relaxed);
+    atomic_fetch_or_explicit(&gauges_set, 1u << gauge, memory_order_relaxed);
+  }
+}
+
+/**
+ * count a response by its status class
+ */
+void metrics_status(int status) {
+  metrics_shard *sp = get_shard();
+
+  if (sp && status >= 0 && status / 100 < METRIC_STATUS_CLASSES) {
+    bump(&sp->status[status / 100], 1);
+  }
+}
+
+/**
+ * record one request's service time
+ */
+void metrics_latency(uint64_t ns) {
+  metrics_shard *sp = get_shard();
+  unsigned seq;
+
+  if (!sp) {
+    return;
+  }
+  // seqlock: readers retry if they saw an odd or changed sequence
+  seq = atomic_load_explicit(&sp->seq, memory_order_relaxed);
+  atomic_store_explicit(&sp->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  hist_record(&sp->latency, ns);
+  atomic_store_explicit(&sp->seq, seq + 2, memory_order_release);
+}
+
+uint64_t metrics_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * a consistent copy of a shard's histogram, taken while its owner may be
+ * recording into it
+ */
+static void copy_latency(metrics_shard *sp, hist *h) {
+  unsigned before, after;
+
+  do {
+    before = atomic_load_explicit(&sp->seq, memory_order_acquire);
+    memcpy(h, &sp->latency, sizeof(hist));
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&sp->seq, memory_order_relaxed);
+  } while ((before & 1) || before != after);
+}
+
+/**
+ * sum every thread's shard, including those of threads that have exited
+ */
+void metrics_snapshot_take(metrics_snapshot *s) {
+  metrics_shard *sp;
+  hist *h = malloc(sizeof(hist));
+  int i;
+
+  memset(s, 0, sizeof(metrics_snapshot));
+  hist_init(&s->latency);
+  for (sp = atomic_load(&shards); sp; sp = sp->next) {
+    s->threads += atomic_load_explicit(&sp->in_use, memory_order_relaxed);
+    for (i = 0; i < METRIC_COUNT; i++) {
+      s->counters[i] +=
+          atomic_load_explicit(&sp->counters[i], memory_order_relaxed);
+    }
+    for (i = 0; i < METRIC_STATUS_CLASSES; i++) {
+      s->status[i] += atomic_load_explicit(&sp->status[i], memory_order_relaxed);
+    }
+    if (h) {
+      copy_latency(sp, h);
+      hist_merge(&s->latency, h);
+    }
+  }
+  free(h);
+  s->gauges_set = atomic_load_explicit(&gauges_set, memory_order_relaxed);
+  for (i = 0; i < METRIC_GAUGE_COUNT; i++) {
+    s->gauges[i] = atomic_load_explicit(&gauges[i], memory_order_relaxed);
+  }
+}
+
+/**
+ * render a snapshot as "name value" lines; returns the length, truncated to
+ * fit `len` like snprintf. Status classes appear once any response has been
+ * counted, so echo's report has none.
+ */
+size_t metrics_format(const metrics_snapshot *s, char *buf, size_t len) {
+  static const double percentiles[] = {50, 90, 99, 99.9};
+  static const char *percentile_names[] = {"p50", "p90", "p99", "p999"};
+  size_t n = 0;
+  int i, has_status = 0;
+
+// append while there is room; n keeps counting past the end, like snprintf
+#define PUT(...)                                                               \
+  n += snprintf(buf + (n < len ? n : len), n < len ? len - n : 0, __VA_ARGS__)
+
+  PUT("threads %d\n", s->threads);
+  for (i = 0; i < METRIC_COUNT; i++) {
+    PUT("%s %llu\n", metrics_names[i], (unsigned long long)s->counters[i]);
+  }
+  for (i = 1; i < METRIC_STATUS_CLASSES && !has_status; i++) {
+    has_status = s->status[i] != 0;
+  }
+  for (i = 1; i < METRIC_STATUS_CLASSES && has_status; i++) {
+    PUT("status_%dxx %llu\n", i, (unsigned long long)s->status[i]);
+  }
+  for (i = 0; i < METRIC_GAUGE_COUNT; i++) {
+    if (s->gauges_set & (1u << i)) {
+      PUT("%s %lld\n", metrics_gauge_names[i], (long long)s->gauges[i]);
+    }
+  }
+  PUT("latency_count %llu\n", (unsigned long long)s->latency.count);
+  for (i = 0; i < 4; i++) {
+    PUT("latency_us_%s %.1f\n", percentile_names[i],
+        hist_percentile(&s->latency, percentiles[i]) / 1e3);
+  }
+  PUT("latency_us_max %.1f\n", s->latency.max / 1e3);
+  PUT("latency_us_mean %.1f\n", hist_mean(&s->latency) / 1e3);
+#undef PUT
+  return n;
+}
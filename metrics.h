@@ -0,0 +1,77 @@
+#ifndef INCLUDED_METRICS_H
+#define INCLUDED_METRICS_H
+
+#include "hist.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Server metrics kept per thread: each thread only ever writes its own
+ * cache-line-aligned shard, so counting costs a plain store and never
+ * bounces a line between cores. Readers sum the shards into a snapshot.
+ * An exiting thread's shard is taken over by the next thread to count.
+ */
+enum {
+  METRIC_CONNS,     // connections accepted
+  METRIC_REQUESTS,  // requests (or echo batches) served
+  METRIC_BYTES_IN,  // bytes read from clients
+  METRIC_BYTES_OUT, // bytes written to clients
+  METRIC_ERRORS,    // connections lost to I/O errors or timeouts
+  METRIC_COUNT
+};
+
+#define METRIC_STATUS_CLASSES 6 // responses by status / 100: 0xx .. 5xx
+
+/**
+ * process-wide levels, set by whoever owns them rather than summed across
+ * threads; a gauge never set is left out of the report
+ */
+enum {
+  METRIC_GAUGE_WORKERS,        // worker threads running
+  METRIC_GAUGE_BUSY,           // workers handling a request
+  METRIC_GAUGE_QUEUE_DEPTH,    // requests waiting for a worker
+  METRIC_GAUGE_QUEUE_DELAY_US, // longest such wait lately
+  METRIC_GAUGE_COUNT
+};
+
+typedef struct {
+  int threads; // live threads that have counted something
+  uint64_t counters[METRIC_COUNT];
+  uint64_t status[METRIC_STATUS_CLASSES];
+  int64_t gauges[METRIC_GAUGE_COUNT];
+  unsigned gauges_set; // bit per gauge
+  hist latency;        // request service time, ns
+} metrics_snapshot;
+
+extern const char *metrics_names[METRIC_COUNT];
+extern const char *metrics_gauge_names[METRIC_GAUGE_COUNT];
+
+void metrics_add(int counter, uint64_t n);
+
+void metrics_set(int gauge, int64_t value);
+
+/**
+ * count a response by its status class
+ */
+void metrics_status(int status);
+
+/**
+ * record one request's service time
+ */
+void metrics_latency(uint64_t ns);
+
+uint64_t metrics_now_ns(void);
+
+/**
+ * sum every thread's shard, including those of threads that have exited
+ */
+void metrics_snapshot_take(metrics_snapshot *s);
+
+/**
+ * render a snapshot as "name value" lines; returns the length, truncated to
+ * fit `len` like snprintf. Status classes appear once any response has been
+ * counted, so echo's report has none.
+ */
+size_t metrics_format(const metrics_snapshot *s, char *buf, size_t len);
+
+#endif
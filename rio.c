@@ -1,9 +1,19 @@
+#define _GNU_SOURCE /* memrchr, splice, copy_file_range */
 #include "rio.h"
+#include "sem.h"
 #include "stdio.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#define RIO_COPY_CHUNK (1 << 20) /* bytes per copy call, and per buffer */
+
 /**
  * unbuffered read
  */
@@ -57,6 +67,39 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n) {
   return n;
 }
 
+/**
+ * unbuffered gather write; `iov` is updated as short writes are resumed
+ */
+ssize_t rio_writevn(int fd, struct iovec *iov, int iovcnt) {
+  size_t n = 0;
+  ssize_t n_written;
+
+  while (iovcnt > 0) {
+    if ((n_written = writev(fd, iov, iovcnt)) <= 0) {
+      if (errno == EINTR) {
+        // interrupted
+        n_written = 0;
+      } else {
+        return -1;
+      }
+    }
+    n += n_written;
+
+    // skip the buffers written in full, then trim a partly written one
+    while (iovcnt > 0 && n_written >= (ssize_t)iov->iov_len) {
+      n_written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n_written;
+      iov->iov_len -= n_written;
+    }
+  }
+
+  return n;
+}
+
 /**
  * associates descriptor `fd` with a read buffer of type `rio_t` at address `rp`
  */
@@ -149,12 +192,278 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
   return (n - n_left);
 }
 
-int main() {
-  int n;
+/**
+ * a single read into the free end of the internal buf
+ */
+ssize_t rio_fillb(rio_t *rp) {
+  ssize_t n;
+
+  // move unread bytes to the front to make room at the end
+  if (rp->rio_cnt > 0 && rp->rio_bufptr != rp->rio_buf) {
+    memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+  }
+  rp->rio_bufptr = rp->rio_buf;
+  if (rp->rio_cnt == sizeof(rp->rio_buf)) {
+    errno = ENOBUFS; /* full: drain it with rio_getlinesb first */
+    return -1;
+  }
+
+  while ((n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+                   sizeof(rp->rio_buf) - rp->rio_cnt)) < 0 &&
+         errno == EINTR) { /* interrupted by sig handler return */
+  }
+  if (n > 0) {
+    rp->rio_cnt += n;
+  }
+  return n;
+}
+
+/**
+ * take every complete line in the internal buf at once, in place
+ */
+ssize_t rio_getlinesb(rio_t *rp, char **linesp) {
+  char *nl = memrchr(rp->rio_bufptr, '\n', rp->rio_cnt);
+  size_t n = nl ? (size_t)(nl - rp->rio_bufptr + 1) : 0;
+
+  if (!nl && rp->rio_cnt == sizeof(rp->rio_buf)) {
+    n = rp->rio_cnt; /* full without a newline: one overlong line */
+  }
+  *linesp = rp->rio_bufptr;
+  rp->rio_bufptr += n;
+  rp->rio_cnt -= n;
+  return n;
+}
+
+/**
+ * one way of moving up to `len` bytes from `in` to `out` inside the kernel
+ */
+typedef ssize_t (*copy_fn)(int in, int out, size_t len);
+
+static ssize_t copy_range(int in, int out, size_t len) {
+  return copy_file_range(in, NULL, out, NULL, len, 0);
+}
+
+static ssize_t copy_sendfile(int in, int out, size_t len) {
+  return sendfile(out, in, NULL, len);
+}
+
+static ssize_t copy_splice(int in, int out, size_t len) {
+  return splice(in, NULL, out, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+/**
+ * does a failure before any byte moved just mean this pair of descriptors
+ * needs another method?
+ */
+static int unsupported(void) {
+  return errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+         errno == EOPNOTSUPP || errno == EBADF || errno == ESPIPE;
+}
+
+/**
+ * run `fn` until EOF; returns bytes copied, -1 on error, or -2 if `fn`
+ * cannot copy between these descriptors at all
+ */
+static ssize_t copy_loop(int in, int out, copy_fn fn) {
+  ssize_t n, total = 0;
+
+  while ((n = fn(in, out, RIO_COPY_CHUNK)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return (total == 0 && unsupported()) ? -2 : -1;
+    }
+    total += n;
+  }
+  return total;
+}
+
+/**
+ * splice through a pipe, for when neither end is one (a socket to a file,
+ * say); -2 if the input cannot be spliced
+ */
+static ssize_t copy_via_pipe(int in, int out) {
+  int p[2];
+  ssize_t n, m, total = 0;
+  char buf[RIO_BUFSIZE];
+
+  if (pipe2(p, O_CLOEXEC) < 0) {
+    return -2;
+  }
+  fcntl(p[1], F_SETPIPE_SZ, RIO_COPY_CHUNK); // a hint; the default is 64K
+  while ((n = copy_splice(in, p[1], RIO_COPY_CHUNK)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      total = (total == 0 && unsupported()) ? -2 : -1;
+      break;
+    }
+    while (n > 0) { /* drain the pipe into the output */
+      if ((m = copy_splice(p[0], out, n)) < 0 && errno == EINTR) {
+        continue;
+      }
+      if (m < 0 && unsupported()) {
+        // the output takes no splices: move what is in the pipe by hand
+        m = read(p[0], buf, (n < RIO_BUFSIZE) ? n : RIO_BUFSIZE);
+        if (m > 0 && rio_writen(out, buf, m) != m) {
+          m = -1;
+        }
+      }
+      if (m <= 0) {
+        total = -1;
+        goto done;
+      }
+      n -= m;
+      total += m;
+    }
+  }
+
+done:
+  close(p[0]);
+  close(p[1]);
+  return total;
+}
+
+/**
+ * two buffers shared by the reading (calling) thread and a writer thread,
+ * so one is filled while the other drains
+ */
+typedef struct {
+  int fd_out;
+  char *bufs[2];
+  ssize_t lens[2];      // bytes in each; 0 at EOF, -1 after a read error
+  sem_t full[2];        // counts a buffer ready to write
+  sem_t empty[2];       // counts a buffer ready to fill
+  atomic_int failed;    // the writer hit an error
+} copy_buffers;
+
+static void *copy_writer(void *vargp) {
+  copy_buffers *cb = vargp;
+  int i;
+
+  for (i = 0;; i ^= 1) {
+    P(&cb->full[i]);
+    if (cb->lens[i] <= 0) {
+      break;
+    }
+    if (!atomic_load(&cb->failed) &&
+        rio_writen(cb->fd_out, cb->bufs[i], cb->lens[i]) < 0) {
+      atomic_store(&cb->failed, 1);
+    }
+    V(&cb->empty[i]);
+  }
+  return NULL;
+}
+
+/**
+ * read and write through two large page-aligned buffers, overlapped
+ */
+static ssize_t copy_buffered(int in, int out) {
+  copy_buffers cb = {.fd_out = out};
+  pthread_t tid;
+  ssize_t n, total = 0;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    cb.bufs[i] = aligned_alloc(4096, RIO_COPY_CHUNK);
+    sem_init(&cb.full[i], 0, 0);
+    sem_init(&cb.empty[i], 0, 1);
+  }
+  atomic_init(&cb.failed, 0);
+  if (!cb.bufs[0] || !cb.bufs[1] ||
+      pthread_create(&tid, NULL, copy_writer, &cb) != 0) {
+    total = -1;
+    goto done;
+  }
+
+  for (i = 0;; i ^= 1) {
+    P(&cb.empty[i]);
+    while ((n = read(in, cb.bufs[i], RIO_COPY_CHUNK)) < 0 && errno == EINTR) {
+    }
+    cb.lens[i] = atomic_load(&cb.failed) ? -1 : n;
+    V(&cb.full[i]); /* also tells the writer to stop */
+    if (cb.lens[i] <= 0) {
+      break;
+    }
+    total += n;
+  }
+  pthread_join(tid, NULL);
+  if (n < 0 || atomic_load(&cb.failed)) {
+    total = -1;
+  }
+
+done:
+  for (i = 0; i < 2; i++) {
+    free(cb.bufs[i]);
+    sem_destroy(&cb.full[i]);
+    sem_destroy(&cb.empty[i]);
+  }
+  return total;
+}
+
+/**
+ * copy from `fd_in` to `fd_out` until EOF, without going through user
+ * space when the pair allows it
+ */
+ssize_t rio_copy(int fd_in, int fd_out) {
+  struct stat in, out;
+  ssize_t n = -2;
+  int in_file;
+
+  if (fstat(fd_in, &in) < 0 || fstat(fd_out, &out) < 0) {
+    return -1;
+  }
+  // files sized 0 may be generated (procfs): only read() sees their data
+  in_file = S_ISREG(in.st_mode) && in.st_size > 0;
+
+  if (in_file && S_ISREG(out.st_mode)) {
+    n = copy_loop(fd_in, fd_out, copy_range);
+  }
+  if (n == -2 && in_file) {
+    n = copy_loop(fd_in, fd_out, copy_sendfile);
+  }
+  if (n == -2 && (S_ISFIFO(in.st_mode) ||
+                  (S_ISSOCK(in.st_mode) && S_ISFIFO(out.st_mode)))) {
+    n = copy_loop(fd_in, fd_out, copy_splice);
+  }
+  if (n == -2 && S_ISSOCK(in.st_mode)) {
+    n = copy_via_pipe(fd_in, fd_out);
+  }
+  return (n == -2) ? copy_buffered(fd_in, fd_out) : n;
+}
+
+#ifdef RIO_MAIN
+/**
+ * copy stdin to stdout a line at a time; build with -DRIO_MAIN. With -c,
+ * stream src (default stdin) to dst (default stdout) with rio_copy.
+ */
+int main(int argc, char **argv) {
+  int n, in = STDIN_FILENO, out = STDOUT_FILENO;
   rio_t rio;
   char buf[MAXLINE];
+
+  if (argc > 1 && !strcmp(argv[1], "-c")) {
+    if (argc > 2 && (in = open(argv[2], O_RDONLY)) < 0) {
+      perror(argv[2]);
+      return 1;
+    }
+    if (argc > 3 &&
+        (out = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+      perror(argv[3]);
+      return 1;
+    }
+    if (rio_copy(in, out) < 0) {
+      perror("rio_copy");
+      return 1;
+    }
+    return 0;
+  }
+
   rio_readinitb(&rio, STDIN_FILENO);
   while ((n = rio_readlineb(&rio, buf, MAXLINE)) != 0) {
     rio_writen(STDOUT_FILENO, buf, n);
   }
 }
+#endif
@@ -7,6 +7,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 typedef struct {
   int rio_fd;                // descriptor for this internal buf
@@ -23,6 +24,10 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n);
  * unbuffered write
  */
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+/**
+ * unbuffered gather write; `iov` is updated as short writes are resumed
+ */
+ssize_t rio_writevn(int fd, struct iovec *iov, int iovcnt);
 
 /**
  * associates descriptor `fd` with a read buffer of type `rio_t` at address `rp`
@@ -39,4 +44,26 @@ ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t max_len);
  */
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 
+/**
+ * a single read into the free end of the internal buf, for descriptors
+ * driven by select/epoll; -1 with errno EAGAIN if nothing was ready
+ */
+ssize_t rio_fillb(rio_t *rp);
+
+/**
+ * take every complete line already in the internal buf without copying:
+ * `*linesp` points into the buf and stays valid until the next read into
+ * it. Returns their total length, 0 if no whole line is buffered.
+ */
+ssize_t rio_getlinesb(rio_t *rp, char **linesp);
+
+/**
+ * copy from `fd_in` to `fd_out` until EOF, without going through user
+ * space when the pair allows it: copy_file_range between files, sendfile
+ * from a file, splice to or from a pipe (or through one, from a socket).
+ * Anything else is read and written through two 1M buffers, overlapped.
+ * For blocking descriptors; returns the bytes copied, -1 on error.
+ */
+ssize_t rio_copy(int fd_in, int fd_out);
+
 #endif
@@ -0,0 +1,144 @@
+/**
+ * rio_bench.c - copy throughput of rio_copy against the line-at-a-time
+ * rio_readlineb + rio_writen loop
+ *
+ *   gcc -O2 -pthread -o rio_bench rio_bench.c rio.c
+ *   ./rio_bench [megabytes] [dir]
+ *
+ * Copies a freshly written (so page-cached) file of text lines to another
+ * file in `dir`, and into a pipe drained by a second thread.
+ */
+#include "rio.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINE_LEN 80
+#define DRAIN_BUFSIZE (1 << 20)
+
+typedef struct {
+  int fd;
+  long long bytes; // read from the pipe
+  pthread_t tid;
+} drain_thread;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *drain(void *vargp) {
+  drain_thread *d = vargp;
+  char *buf = malloc(DRAIN_BUFSIZE);
+  ssize_t n;
+
+  while ((n = read(d->fd, buf, DRAIN_BUFSIZE)) > 0) {
+    d->bytes += n;
+  }
+  free(buf);
+  return NULL;
+}
+
+static long long copy_lines(int in, int out) {
+  rio_t rio;
+  char buf[MAXLINE];
+  ssize_t n;
+  long long total = 0;
+
+  rio_readinitb(&rio, in);
+  while ((n = rio_readlineb(&rio, buf, MAXLINE)) > 0) {
+    if (rio_writen(out, buf, n) != n) {
+      return -1;
+    }
+    total += n;
+  }
+  return total;
+}
+
+/**
+ * one copy of `src` to a file or a pipe; returns GB/s, or -1 if bytes were
+ * lost
+ */
+static double run(const char *src, const char *dst, int to_pipe,
+                  int use_copy, long long size) {
+  drain_thread d = {0};
+  int in = open(src, O_RDONLY), out, p[2];
+  long long copied;
+  double t0, elapsed;
+
+  if (to_pipe) {
+    if (pipe(p) < 0) {
+      return -1;
+    }
+    out = p[1];
+    d.fd = p[0];
+    pthread_create(&d.tid, NULL, drain, &d);
+  } else {
+    out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+
+  t0 = now_sec();
+  copied = use_copy ? rio_copy(in, out) : copy_lines(in, out);
+  if (to_pipe) {
+    close(out);
+    pthread_join(d.tid, NULL);
+    close(d.fd);
+    copied = (copied == d.bytes) ? copied : -1;
+  } else {
+    close(out); // into the page cache: writeback is not timed
+  }
+  elapsed = now_sec() - t0;
+  close(in);
+  return (copied == size) ? size / elapsed / 1e9 : -1;
+}
+
+int main(int argc, char **argv) {
+  long long mb = (argc > 1) ? atoll(argv[1]) : 256, size, i, n;
+  const char *dir = (argc > 2) ? argv[2] : "/tmp";
+  const char *targets[] = {"file", "pipe"};
+  char src[4096], dst[4096], *block = malloc(DRAIN_BUFSIZE);
+  double gbs;
+  int fd, t, use_copy, j;
+
+  snprintf(src, sizeof(src), "%s/rio_bench.src", dir);
+  snprintf(dst, sizeof(dst), "%s/rio_bench.dst", dir);
+  if ((fd = open(src, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror(src);
+    return 1;
+  }
+  // whole lines, written a block at a time
+  size = mb * 1024 * 1024 / (LINE_LEN + 1) * (LINE_LEN + 1);
+  for (j = 0; j < DRAIN_BUFSIZE; j++) {
+    block[j] = (j % (LINE_LEN + 1) == LINE_LEN) ? '\n' : 'a' + j % 26;
+  }
+  for (i = 0; i < size; i += n) {
+    n = (size - i < DRAIN_BUFSIZE / (LINE_LEN + 1) * (LINE_LEN + 1))
+            ? size - i
+            : DRAIN_BUFSIZE / (LINE_LEN + 1) * (LINE_LEN + 1);
+    rio_writen(fd, block, n);
+  }
+  close(fd);
+  free(block);
+
+  printf("%lld bytes in %d-byte lines, GB/s\n", size, LINE_LEN + 1);
+  printf("%-8s %10s %10s\n", "to", "lines", "rio_copy");
+  for (t = 0; t < 2; t++) {
+    printf("%-8s", targets[t]);
+    for (use_copy = 0; use_copy < 2; use_copy++) {
+      if ((gbs = run(src, dst, t, use_copy, size)) < 0) {
+        printf(" %10s", "LOST");
+      } else {
+        printf(" %10.2f", gbs);
+      }
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+  unlink(src);
+  unlink(dst);
+  return 0;
+}
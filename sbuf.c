@@ -2,47 +2,411 @@
  * A package for synchronizing concurrent access to bounded buffers
  */
 #include "sbuf.h"
-#include "semaphore.h"
+#include "futex.h"
+#include "sem.h"
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define SBUF_SPINS 128 /* failed attempts before a lock-free waiter sleeps */
 
 /**
- * create an empty, bounded, shared FIFO buffer with n slots
+ * create an empty, bounded, shared FIFO buffer with n slots of int
  */
 void sbuf_init(sbuf_t *sp, int n) {
-  sp->buf = calloc(n, sizeof(int));
-  sp->n = n;
-  sp->front = sp->rear = 0;   /* empty buffer iff front == rear */
-  sem_init(&sp->mutex, 0, 1); /* binary semaphore for locking */
-  sem_init(&sp->slots, 0, n); /* initially buf has n empty slots */
-  sem_init(&sp->items, 0, 0); /* initially buf has zero data items */
+  sbuf_init_kind(sp, n, SBUF_LOCKED, sizeof(int));
+}
+
+/**
+ * same, synchronized as `kind`, with items of `size` bytes; the lock-free
+ * kinds round n up to a power of two. Returns -1 if `kind` is unknown or
+ * memory runs out.
+ */
+int sbuf_init_kind(sbuf_t *sp, int n, int kind, size_t size) {
+  unsigned slots = 1, i;
+
+  sp->kind = kind;
+  sp->size = size;
+  sp->buf = NULL;
+  sp->seqs = NULL;
+  if (kind == SBUF_LOCKED) {
+    sp->buf = calloc(n, size);
+    sp->n = n;
+    sp->front = sp->rear = 0;   /* empty buffer iff front == rear */
+    sem_init(&sp->mutex, 0, 1); /* binary semaphore for locking */
+    sem_init(&sp->slots, 0, n); /* initially buf has n empty slots */
+    sem_init(&sp->items, 0, 0); /* initially buf has zero data items */
+    return sp->buf ? 0 : -1;
+  }
+  if (kind != SBUF_SPSC && kind != SBUF_MPMC) {
+    return -1;
+  }
+
+  // a power of two, so the free-running positions wrap cleanly
+  while (slots < (unsigned)n) {
+    slots <<= 1;
+  }
+  sp->n = slots;
+  sp->mask = slots - 1;
+  atomic_init(&sp->head, 0);
+  atomic_init(&sp->tail, 0);
+  sp->cached_head = sp->cached_tail = 0;
+  atomic_init(&sp->items_futex, 0);
+  atomic_init(&sp->items_waiters, 0);
+  atomic_init(&sp->slots_futex, 0);
+  atomic_init(&sp->slots_waiters, 0);
+  if (!(sp->buf = calloc(slots, size))) {
+    return -1;
+  }
+  if (kind == SBUF_MPMC) {
+    if (!(sp->seqs = calloc(slots, sizeof(atomic_uint)))) {
+      free(sp->buf);
+      return -1;
+    }
+    for (i = 0; i < slots; i++) {
+      atomic_init(&sp->seqs[i], i);
+    }
+  }
+  return 0;
 }
 
 /**
  * clean up buffer sp
  */
-void sbuf_deinit(sbuf_t *sp) { free(sp->buf); }
+void sbuf_deinit(sbuf_t *sp) {
+  if (sp->kind == SBUF_LOCKED) {
+    sem_destroy(&sp->mutex);
+    sem_destroy(&sp->slots);
+    sem_destroy(&sp->items);
+  }
+  free(sp->buf);
+  free(sp->seqs);
+}
 
 /**
- * Insert item onto the rear of buffer sp
+ * locked: take one semaphore count (waiting for it if `block`) and then as
+ * many more as are free, up to k, so one lock covers the whole batch
+ */
+static int locked_take(sem_t *s, int k, int block) {
+  int c = 0;
+
+  if (block) {
+    P(s);
+    c = 1;
+  }
+  while (c < k && sem_trywait(s) == 0) {
+    c++;
+  }
+  return c;
+}
+
+static int locked_insert(sbuf_t *sp, const char *items, int k, int block) {
+  int i, c = locked_take(&sp->slots, k, block); /* wait for slots */
+
+  if (c == 0) {
+    return 0;
+  }
+  P(&sp->mutex); /* lock the buffer */
+  for (i = 0; i < c; i++) {
+    sp->rear = (sp->rear + 1) % sp->n; /* kept in range: no overflow */
+    memcpy(sp->buf + sp->rear * sp->size, items + i * sp->size, sp->size);
+  }
+  V(&sp->mutex); /* unlock the buffer */
+  for (i = 0; i < c; i++) {
+    V(&sp->items); /* announce available items */
+  }
+  return c;
+}
+
+static int locked_remove(sbuf_t *sp, char *items, int k, int block) {
+  int i, c = locked_take(&sp->items, k, block); /* wait for items */
+
+  if (c == 0) {
+    return 0;
+  }
+  P(&sp->mutex); /* lock the buffer */
+  for (i = 0; i < c; i++) {
+    sp->front = (sp->front + 1) % sp->n; /* kept in range: no overflow */
+    memcpy(items + i * sp->size, sp->buf + sp->front * sp->size, sp->size);
+  }
+  V(&sp->mutex); /* unlock the buffer */
+  for (i = 0; i < c; i++) {
+    V(&sp->slots); /* announce available slots */
+  }
+  return c;
+}
+
+/**
+ * copy k items into the ring from position pos, or out of it, in at most
+ * two pieces
  */
-void sbuf_insert(sbuf_t *sp, int item) {
-  P(&sp->slots);                          /* wait for available slot */
-  P(&sp->mutex);                          /* lock the buffer */
-  sp->buf[(++sp->rear) % (sp->n)] = item; /* insert the item */
-  V(&sp->mutex);                          /* unlock the buffer */
-  V(&sp->items);                          /* announce available item */
+static void ring_copy(sbuf_t *sp, unsigned pos, char *items, unsigned k,
+                      int into_ring) {
+  unsigned idx = pos & sp->mask;
+  size_t first = (k < sp->n - idx) ? k : sp->n - idx;
+  char *ring = sp->buf + idx * sp->size;
+
+  if (into_ring) {
+    memcpy(ring, items, first * sp->size);
+    memcpy(sp->buf, items + first * sp->size, (k - first) * sp->size);
+  } else {
+    memcpy(items, ring, first * sp->size);
+    memcpy(items + first * sp->size, sp->buf, (k - first) * sp->size);
+  }
 }
 
+/**
+ * SPSC: only the producer moves tail and only the consumer moves head, so
+ * each side rereads the other's counter only when its cached copy says
+ * there is not enough room (or not enough items)
+ */
+static int spsc_insert(sbuf_t *sp, const char *items, unsigned k) {
+  unsigned tail = atomic_load_explicit(&sp->tail, memory_order_relaxed);
+  unsigned room = sp->n - (tail - sp->cached_head);
+
+  if (room < k) {
+    sp->cached_head = atomic_load_explicit(&sp->head, memory_order_acquire);
+    room = sp->n - (tail - sp->cached_head);
+  }
+  if ((k = (room < k) ? room : k) == 0) {
+    return 0;
+  }
+  ring_copy(sp, tail, (char *)items, k, 1);
+  atomic_store_explicit(&sp->tail, tail + k, memory_order_release);
+  return k;
+}
+
+static int spsc_remove(sbuf_t *sp, char *items, unsigned k) {
+  unsigned head = atomic_load_explicit(&sp->head, memory_order_relaxed);
+  unsigned avail = sp->cached_tail - head;
+
+  if (avail < k) {
+    sp->cached_tail = atomic_load_explicit(&sp->tail, memory_order_acquire);
+    avail = sp->cached_tail - head;
+  }
+  if ((k = (avail < k) ? avail : k) == 0) {
+    return 0;
+  }
+  ring_copy(sp, head, items, k, 0);
+  atomic_store_explicit(&sp->head, head + k, memory_order_release);
+  return k;
+}
+
+/**
+ * MPMC (Vyukov's bounded queue, claiming runs of slots): a slot at
+ * position pos is free for the insert at pos when its sequence is pos,
+ * and holds that item when it is pos + 1. One CAS on tail (or head)
+ * claims the whole run of ready slots found at the front.
+ */
+static int mpmc_claim(sbuf_t *sp, atomic_uint *end, int k, unsigned ready,
+                      unsigned *posp) {
+  unsigned pos = atomic_load_explicit(end, memory_order_relaxed);
+  int diff, c;
+
+  while (1) {
+    diff = (int)(atomic_load_explicit(&sp->seqs[pos & sp->mask],
+                                      memory_order_acquire) -
+                 (pos + ready));
+    if (diff < 0) { /* the other side has not got here yet */
+      return 0;
+    }
+    if (diff > 0) { /* another thread claimed it; catch up */
+      pos = atomic_load_explicit(end, memory_order_relaxed);
+      continue;
+    }
+    for (c = 1; c < k && atomic_load_explicit(&sp->seqs[(pos + c) & sp->mask],
+                                              memory_order_acquire) ==
+                             pos + c + ready;
+         c++) {
+    }
+    // nobody else can take these slots without first moving `end`
+    if (atomic_compare_exchange_weak_explicit(
+            end, &pos, pos + c, memory_order_relaxed, memory_order_relaxed)) {
+      *posp = pos;
+      return c;
+    }
+  }
+}
+
+static int mpmc_insert(sbuf_t *sp, const char *items, int k) {
+  unsigned pos;
+  int i, c = mpmc_claim(sp, &sp->tail, k, 0, &pos);
+
+  if (c == 0) {
+    return 0;
+  }
+  ring_copy(sp, pos, (char *)items, c, 1);
+  for (i = 0; i < c; i++) { /* hand each slot to the consumers */
+    atomic_store_explicit(&sp->seqs[(pos + i) & sp->mask], pos + i + 1,
+                          memory_order_release);
+  }
+  return c;
+}
+
+static int mpmc_remove(sbuf_t *sp, char *items, int k) {
+  unsigned pos;
+  int i, c = mpmc_claim(sp, &sp->head, k, 1, &pos);
+
+  if (c == 0) {
+    return 0;
+  }
+  ring_copy(sp, pos, items, c, 0);
+  for (i = 0; i < c; i++) { /* free each slot for the insert a lap ahead */
+    atomic_store_explicit(&sp->seqs[(pos + i) & sp->mask], pos + i + sp->n,
+                          memory_order_release);
+  }
+  return c;
+}
+
+/**
+ * wake up to `n` threads sleeping on the other side, if there are any.
+ * The fence pairs with the one in a sleeper's registration: either we see
+ * it waiting, or it sees what we just inserted or removed.
+ */
+static void wake(atomic_uint *futex, atomic_uint *waiters, int n) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiters, memory_order_relaxed)) {
+    atomic_fetch_add(futex, 1);
+    futex_wake(futex, n);
+  }
+}
+
+/**
+ * one lock-free attempt at moving up to k items, waking the other side
+ * once for the whole batch
+ */
+static int lockfree_move(sbuf_t *sp, char *items, int k, int inserting) {
+  int c;
+
+  if (inserting) {
+    c = (sp->kind == SBUF_SPSC) ? spsc_insert(sp, items, k)
+                                : mpmc_insert(sp, items, k);
+    if (c > 0) {
+      wake(&sp->items_futex, &sp->items_waiters, c);
+    }
+  } else {
+    c = (sp->kind == SBUF_SPSC) ? spsc_remove(sp, items, k)
+                                : mpmc_remove(sp, items, k);
+    if (c > 0) {
+      wake(&sp->slots_futex, &sp->slots_waiters, c);
+    }
+  }
+  return c;
+}
+
+/**
+ * move at least one of up to k items, spinning briefly and then sleeping
+ * until the other side makes room (or items)
+ */
+static int lockfree_move_wait(sbuf_t *sp, char *items, int k, int inserting) {
+  atomic_uint *futex = inserting ? &sp->slots_futex : &sp->items_futex;
+  atomic_uint *waiters = inserting ? &sp->slots_waiters : &sp->items_waiters;
+  unsigned seen;
+  int c, spins = 0;
+
+  while ((c = lockfree_move(sp, items, k, inserting)) == 0) {
+    if (++spins < SBUF_SPINS) {
+      cpu_relax();
+      continue;
+    }
+    seen = atomic_load(futex);
+    atomic_fetch_add(waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst); /* pairs with wake */
+    if ((c = lockfree_move(sp, items, k, inserting)) > 0) {
+      atomic_fetch_sub(waiters, 1);
+      break;
+    }
+    futex_wait(futex, seen);
+    atomic_fetch_sub(waiters, 1);
+  }
+  return c;
+}
+
+/**
+ * insert all `n` items of `items`, in order, waiting while the buffer is
+ * full
+ */
+void sbuf_insert_n(sbuf_t *sp, const void *items, int n) {
+  const char *p = items;
+  int c;
+
+  while (n > 0) {
+    c = (sp->kind == SBUF_LOCKED)
+            ? locked_insert(sp, p, n, 1)
+            : lockfree_move_wait(sp, (char *)p, n, 1);
+    p += c * sp->size;
+    n -= c;
+  }
+}
+
+/**
+ * remove up to `max` items, waiting only until there is at least one
+ */
+int sbuf_remove_n(sbuf_t *sp, void *items, int max) {
+  if (max <= 0) {
+    return 0;
+  }
+  return (sp->kind == SBUF_LOCKED) ? locked_remove(sp, items, max, 1)
+                                   : lockfree_move_wait(sp, items, max, 0);
+}
+
+int sbuf_try_insert_n(sbuf_t *sp, const void *items, int n) {
+  if (n <= 0) {
+    return 0;
+  }
+  return (sp->kind == SBUF_LOCKED) ? locked_insert(sp, items, n, 0)
+                                   : lockfree_move(sp, (char *)items, n, 1);
+}
+
+int sbuf_try_remove_n(sbuf_t *sp, void *items, int max) {
+  if (max <= 0) {
+    return 0;
+  }
+  return (sp->kind == SBUF_LOCKED) ? locked_remove(sp, items, max, 0)
+                                   : lockfree_move(sp, items, max, 0);
+}
+
+/**
+ * how many items are in the buffer; only a hint, as other threads may be
+ * moving items while it is taken
+ */
+int sbuf_count(sbuf_t *sp) {
+  int count;
+
+  if (sp->kind == SBUF_LOCKED) {
+    sem_getvalue(&sp->items, &count);
+    return count;
+  }
+  // claimed positions, so items still being copied in already count
+  count = (int)(atomic_load_explicit(&sp->tail, memory_order_relaxed) -
+                atomic_load_explicit(&sp->head, memory_order_relaxed));
+  return (count < 0) ? 0 : (count > sp->n) ? sp->n : count;
+}
+
+/**
+ * Insert item onto the rear of buffer sp
+ */
+void sbuf_insert(sbuf_t *sp, int item) { sbuf_insert_n(sp, &item, 1); }
+
 /**
  * Remove and return first item from buffer sp
  */
 int sbuf_remove(sbuf_t *sp) {
   int item;
-  P(&sp->items);                           /* wait for available item */
-  P(&sp->mutex);                           /* lock the buffer */
-  item = sp->buf[(++sp->front) % (sp->n)]; /* remove the item */
-  V(&sp->mutex);                           /* unlock the buffer */
-  V(&sp->slots);                           /* announce available slot */
-
+  sbuf_remove_n(sp, &item, 1);
   return item;
 }
+
+/**
+ * insert without waiting; -1 if the buffer is full
+ */
+int sbuf_try_insert(sbuf_t *sp, int item) {
+  return sbuf_try_insert_n(sp, &item, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * remove without waiting into *item; -1 if the buffer is empty
+ */
+int sbuf_try_remove(sbuf_t *sp, int *item) {
+  return sbuf_try_remove_n(sp, item, 1) == 1 ? 0 : -1;
+}
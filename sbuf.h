@@ -2,15 +2,105 @@
 #define INCLUDED_SBUF_H
 
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * how a buffer synchronizes; chosen once, at init
+ */
+enum {
+  SBUF_LOCKED, /* semaphores and a mutex: any number of threads */
+  SBUF_SPSC,   /* lock-free, one producer thread and one consumer thread */
+  SBUF_MPMC,   /* lock-free, any number of producers and consumers */
+};
 
 typedef struct {
-  int *buf;    /* buffer array */
+  int kind;    /* SBUF_* */
+  size_t size; /* bytes per item, fixed at init */
+  char *buf;   /* buffer array of n items */
   int n;       /* max number of slots */
   int front;   /* buf[(front + 1) % n] is the first item */
-  int rear;    /* buf[read % n] is the last item */
+  int rear;    /* buf[rear] is the last item */
   sem_t mutex; /* protects accesses to buf */
   sem_t slots; /* counts available slots */
   sem_t items; /* counts available items */
+
+  /* lock-free kinds: n is a power of two and positions are free-running
+     unsigned counters, masked to index the ring */
+  atomic_uint *seqs;                    /* SBUF_MPMC: whose turn each slot is */
+  unsigned mask;                        /* n - 1 */
+  _Alignas(64) atomic_uint head;        /* next item to remove */
+  unsigned cached_tail;                 /* consumer's last look at tail */
+  _Alignas(64) atomic_uint tail;        /* next slot to fill */
+  unsigned cached_head;                 /* producer's last look at head */
+  _Alignas(64) atomic_uint items_futex; /* bumped to wake consumers */
+  atomic_uint items_waiters;            /* consumers asleep on empty */
+  _Alignas(64) atomic_uint slots_futex; /* bumped to wake producers */
+  atomic_uint slots_waiters;            /* producers asleep on full */
 } sbuf_t;
 
+/**
+ * create an empty, bounded, shared FIFO buffer with n slots of int
+ */
+void sbuf_init(sbuf_t *sp, int n);
+
+/**
+ * same, synchronized as `kind`, with items of `size` bytes (an fd, a
+ * pointer, a small struct); the lock-free kinds round n up to a power of
+ * two. Returns -1 if `kind` is unknown or memory runs out.
+ */
+int sbuf_init_kind(sbuf_t *sp, int n, int kind, size_t size);
+
+/**
+ * clean up buffer sp
+ */
+void sbuf_deinit(sbuf_t *sp);
+
+/**
+ * insert all `n` items of `items`, in order, waiting while the buffer is
+ * full; each batch that fits costs one lock (or claim) and one wakeup
+ */
+void sbuf_insert_n(sbuf_t *sp, const void *items, int n);
+
+/**
+ * remove up to `max` items into `items`, waiting only until there is at
+ * least one; returns how many were removed
+ */
+int sbuf_remove_n(sbuf_t *sp, void *items, int max);
+
+/**
+ * as sbuf_insert_n and sbuf_remove_n but never waiting; return how many
+ * items were moved, possibly 0
+ */
+int sbuf_try_insert_n(sbuf_t *sp, const void *items, int n);
+int sbuf_try_remove_n(sbuf_t *sp, void *items, int max);
+
+/**
+ * how many items are in the buffer; only a hint, as other threads may be
+ * moving items while it is taken
+ */
+int sbuf_count(sbuf_t *sp);
+
+/**
+ * Insert item onto the rear of buffer sp, waiting while it is full; for
+ * buffers of int
+ */
+void sbuf_insert(sbuf_t *sp, int item);
+
+/**
+ * Remove and return first item from buffer sp, waiting while it is empty;
+ * for buffers of int
+ */
+int sbuf_remove(sbuf_t *sp);
+
+/**
+ * insert without waiting; -1 if the buffer is full
+ */
+int sbuf_try_insert(sbuf_t *sp, int item);
+
+/**
+ * remove without waiting into *item; -1 if the buffer is empty
+ */
+int sbuf_try_remove(sbuf_t *sp, int *item);
+
 #endif
@@ -0,0 +1,147 @@
+/**
+ * sbuf_bench.c - throughput of the sbuf kinds as producer/consumer pairs are
+ * added
+ *
+ *   gcc -O2 -pthread -o sbuf_bench sbuf_bench.c sbuf.c
+ *   ./sbuf_bench [items] [slots] [batch]
+ *
+ * Each run has P producers and P consumers moving `items` ints in total
+ * through one buffer; SBUF_SPSC only runs with a single pair. The runs are
+ * repeated moving `batch` items per sbuf_insert_n/sbuf_remove_n call.
+ */
+#include "sbuf.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_PAIRS 16
+#define MAX_BATCH 256
+
+typedef struct {
+  sbuf_t *sp;
+  int count;    // items to move
+  int batch;    // items per call
+  int64_t sum;  // consumers: of the items removed
+  pthread_t tid;
+} bench_thread;
+
+static const char *kind_names[] = {"locked", "spsc", "mpmc"};
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *vargp) {
+  bench_thread *t = vargp;
+  int items[MAX_BATCH], i, j, n;
+
+  if (t->batch == 1) {
+    for (i = 1; i <= t->count; i++) {
+      sbuf_insert(t->sp, i);
+    }
+    return NULL;
+  }
+  for (i = 1; i <= t->count; i += n) {
+    n = (t->count - i + 1 < t->batch) ? t->count - i + 1 : t->batch;
+    for (j = 0; j < n; j++) {
+      items[j] = i + j;
+    }
+    sbuf_insert_n(t->sp, items, n);
+  }
+  return NULL;
+}
+
+static void *consumer(void *vargp) {
+  bench_thread *t = vargp;
+  int items[MAX_BATCH], i, j, n;
+
+  if (t->batch == 1) {
+    for (i = 0; i < t->count; i++) {
+      t->sum += sbuf_remove(t->sp);
+    }
+    return NULL;
+  }
+  for (i = 0; i < t->count; i += n) {
+    n = sbuf_remove_n(t->sp, items,
+                      (t->count - i < t->batch) ? t->count - i : t->batch);
+    for (j = 0; j < n; j++) {
+      t->sum += items[j];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * one run; returns millions of items per second, or -1 if items were lost
+ */
+static double run(int kind, int pairs, int items, int slots, int batch) {
+  bench_thread prod[MAX_PAIRS], cons[MAX_PAIRS];
+  int64_t want = 0, got = 0;
+  sbuf_t sbuf;
+  double t0, elapsed;
+  int i, per = items / pairs;
+
+  if (sbuf_init_kind(&sbuf, slots, kind, sizeof(int)) < 0) {
+    return -1;
+  }
+  t0 = now_sec();
+  for (i = 0; i < pairs; i++) {
+    prod[i] = (bench_thread){.sp = &sbuf, .count = per, .batch = batch};
+    cons[i] = (bench_thread){.sp = &sbuf, .count = per, .batch = batch};
+    pthread_create(&cons[i].tid, NULL, consumer, &cons[i]);
+    pthread_create(&prod[i].tid, NULL, producer, &prod[i]);
+  }
+  for (i = 0; i < pairs; i++) {
+    pthread_join(prod[i].tid, NULL);
+    pthread_join(cons[i].tid, NULL);
+    want += (int64_t)per * (per + 1) / 2;
+    got += cons[i].sum;
+  }
+  elapsed = now_sec() - t0;
+  sbuf_deinit(&sbuf);
+  return (got == want) ? per * pairs / elapsed / 1e6 : -1;
+}
+
+int main(int argc, char **argv) {
+  int items = (argc > 1) ? atoi(argv[1]) : 4000000;
+  int slots = (argc > 2) ? atoi(argv[2]) : 1024;
+  int batch = (argc > 3) ? atoi(argv[3]) : 32;
+  int batches[2] = {1, batch}, b, kind, pairs;
+  double mops;
+
+  if (batch < 1 || batch > MAX_BATCH) {
+    fprintf(stderr, "batch must be 1..%d\n", MAX_BATCH);
+    return 1;
+  }
+  for (b = 0; b < (batch > 1 ? 2 : 1); b++) {
+    printf("%d items through %d slots, %d per call, Mitems/s\n", items, slots,
+           batches[b]);
+    printf("%-8s", "pairs");
+    for (kind = SBUF_LOCKED; kind <= SBUF_MPMC; kind++) {
+      printf(" %10s", kind_names[kind]);
+    }
+    printf("\n");
+
+    for (pairs = 1; pairs <= MAX_PAIRS; pairs *= 2) {
+      printf("%-8d", pairs);
+      for (kind = SBUF_LOCKED; kind <= SBUF_MPMC; kind++) {
+        if (kind == SBUF_SPSC && pairs > 1) {
+          printf(" %10s", "-");
+          continue;
+        }
+        if ((mops = run(kind, pairs, items, slots, batches[b])) < 0) {
+          printf(" %10s", "LOST");
+        } else {
+          printf(" %10.2f", mops);
+        }
+        fflush(stdout);
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
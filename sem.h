@@ -0,0 +1,22 @@
+#ifndef INCLUDED_SEM_H
+#define INCLUDED_SEM_H
+
+#include <errno.h>
+#include <semaphore.h>
+
+/**
+ * Dijkstra's P and V on POSIX semaphores, shared by the modules that hand
+ * buffers between threads
+ */
+
+/**
+ * wait on a semaphore, riding out signal interruptions
+ */
+static inline void P(sem_t *s) {
+  while (sem_wait(s) < 0 && errno == EINTR) {
+  }
+}
+
+static inline void V(sem_t *s) { sem_post(s); }
+
+#endif
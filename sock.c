@@ -0,0 +1,141 @@
+/**
+ * Socket helpers shared by the servers and clients
+ */
+#define _GNU_SOURCE /* accept4 */
+#include "sock.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+static int spare_fd = -1; // given up by sock_shed when out of descriptors
+
+/**
+Establish a connection with a server running on `hostname` and listening for
+connection requests on port number `port`
+*/
+int open_clientfd(char *hostname, char *port) {
+  int clientfd, rc;
+  struct addrinfo hints, *listp, *p;
+
+  // get a list of potential server addresses
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM; // open a connection
+  hints.ai_flags = AI_NUMERICSERV; // ... using a numeric port arg
+  hints.ai_flags |= AI_ADDRCONFIG; // recommended for connections
+  if ((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0) {
+    fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", hostname, port,
+            gai_strerror(rc));
+    return -2;
+  }
+
+  // walk the list for one that we can successfully connect to
+  for (p = listp; p; p = p->ai_next) {
+    // create socket descriptor
+    if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
+      continue; // socket failed, try next
+    }
+
+    // connect to server
+    if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) {
+      break; // success
+    }
+    close(clientfd); // connect failed, try another
+  }
+
+  // clean up
+  freeaddrinfo(listp);
+  if (!p) {
+    // _ALL_ connects failed
+    return -1;
+  } else {
+    return clientfd;
+  }
+}
+
+/**
+Return a listening descriptor that is ready to receive connection requests on
+`port`
+*/
+int open_listenfd(char *port) {
+  struct addrinfo hints, *listp, *p;
+  int listenfd, rc, optval = 1;
+
+  // get list of potential server addresses
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;             // accept connections
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; // ... on any IP addresses
+  hints.ai_flags |= AI_NUMERICSERV;            // ... using port number
+  if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
+    fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port,
+            gai_strerror(rc));
+    return -2;
+  }
+
+  // walk the list for one that we can bind to
+  for (p = listp; p; p = p->ai_next) {
+    // create socket descriptor
+    if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
+      continue; // socket failed, try next
+    }
+
+    // eliminate "address already in use" error from bind
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
+               sizeof(int));
+
+    // bind descriptor to address
+    if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) {
+      break; // success
+    }
+
+    close(listenfd); // bind failed, try next
+  }
+
+  // cleanup
+  freeaddrinfo(listp);
+  if (!p) {
+    return -1;
+  }
+
+  // make it a listening socket ready to accept connection requests
+  if (listen(listenfd, LISTENQ) < 0) {
+    close(listenfd);
+    return -1;
+  }
+
+  return listenfd;
+}
+
+/**
+Hold one descriptor in reserve for sock_shed; call once at startup
+*/
+void sock_reserve_spare(void) {
+  if (spare_fd < 0) {
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+}
+
+/**
+Call when accept fails with EMFILE or ENFILE: free the spare to accept and
+close the pending connection, then take the spare back
+*/
+int sock_shed(int listenfd) {
+  struct timespec backoff = {0, 1000000}; // 1ms
+  int connfd;
+
+  if (spare_fd < 0) { // not reopened last time: just slow down
+    nanosleep(&backoff, NULL);
+    sock_reserve_spare();
+    return -1;
+  }
+  close(spare_fd);
+  if ((connfd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+    close(connfd);
+  }
+  spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return (connfd >= 0) ? 0 : -1;
+}
@@ -0,0 +1,31 @@
+#ifndef INCLUDED_SOCK_H
+#define INCLUDED_SOCK_H
+
+#define LISTENQ 1024 /* Second argument to listen() */
+
+/**
+Establish a connection with a server running on `hostname` and listening for
+connection requests on port number `port`
+*/
+int open_clientfd(char *hostname, char *port);
+
+/**
+Return a listening descriptor that is ready to receive connection requests on
+`port`
+*/
+int open_listenfd(char *port);
+
+/**
+Hold one descriptor in reserve for sock_shed; call once at startup
+*/
+void sock_reserve_spare(void);
+
+/**
+Call when accept fails with EMFILE or ENFILE: the pending connection can't be
+taken, so the listener stays ready and a retry would spin. Gives up the spare
+to accept and close it, so the client hears at once; returns 0 if one was
+shed, -1 if it only slowed down. Only the one accepting thread may call it.
+*/
+int sock_shed(int listenfd);
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * A hierarchical timer wheel for connection timeouts
+ */
+#include "timer_wheel.h"
+#include <time.h>
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void list_init(tw_timer *head) { head->next = head->prev = head; }
+
+static void list_add(tw_timer *head, tw_timer *tp) {
+  tp->prev = head->prev;
+  tp->next = head;
+  head->prev->next = tp;
+  head->prev = tp;
+}
+
+static void list_del(tw_timer *tp) {
+  tp->prev->next = tp->next;
+  tp->next->prev = tp->prev;
+  tp->next = tp->prev = NULL;
+}
+
+/**
+ * put an unlinked timer in the slot matching its distance from now
+ */
+static void place(timer_wheel *tw, tw_timer *tp) {
+  uint64_t expires = tp->expires, delta;
+  int level;
+
+  if (expires < tw->now) {
+    expires = tw->now; /* overdue: fire on the next tick */
+  }
+  delta = expires - tw->now;
+  for (level = 0; level < TW_LEVELS - 1; level++) {
+    if (delta < (1ULL << (TW_BITS * (level + 1)))) {
+      break;
+    }
+  }
+  if (delta >= (1ULL << (TW_BITS * TW_LEVELS))) { /* beyond the top wheel */
+    expires = tw->now + (1ULL << (TW_BITS * TW_LEVELS)) - 1;
+  }
+  list_add(&tw->slots[level][(expires >> (TW_BITS * level)) & TW_MASK], tp);
+}
+
+void tw_init(timer_wheel *tw, unsigned tick_ms) {
+  int level, slot;
+
+  tw->tick_ns = (uint64_t)(tick_ms ? tick_ms : 1) * 1000000;
+  tw->start_ns = now_ns();
+  tw->now = 0;
+  tw->n_armed = 0;
+  for (level = 0; level < TW_LEVELS; level++) {
+    for (slot = 0; slot < TW_SLOTS; slot++) {
+      list_init(&tw->slots[level][slot]);
+    }
+  }
+}
+
+void tw_timer_init(tw_timer *tp, void (*fn)(tw_timer *tp)) {
+  tp->next = tp->prev = NULL;
+  tp->expires = 0;
+  tp->fn = fn;
+}
+
+/**
+ * (re)arm `tp` to fire in `ms` milliseconds, rounded up to whole ticks
+ */
+void tw_arm(timer_wheel *tw, tw_timer *tp, unsigned ms) {
+  uint64_t ticks = ((uint64_t)ms * 1000000 + tw->tick_ns - 1) / tw->tick_ns;
+  uint64_t current = (now_ns() - tw->start_ns) / tw->tick_ns;
+
+  tw_cancel(tw, tp);
+  // count from the clock, not from how far tw_advance has got; the extra
+  // tick covers the part of the current one already gone
+  tp->expires = (current > tw->now ? current : tw->now) + ticks + 1;
+  place(tw, tp);
+  tw->n_armed++;
+}
+
+void tw_cancel(timer_wheel *tw, tw_timer *tp) {
+  if (tw_armed(tp)) {
+    list_del(tp);
+    tw->n_armed--;
+  }
+}
+
+/**
+ * move every timer of a coarse slot to where it now belongs
+ */
+static void cascade(timer_wheel *tw, int level, int slot) {
+  tw_timer *head = &tw->slots[level][slot], *tp;
+
+  while (head->next != head) {
+    tp = head->next;
+    list_del(tp);
+    place(tw, tp);
+  }
+}
+
+/**
+ * fire every timer due by now; returns how many fired
+ */
+int tw_advance(timer_wheel *tw) {
+  uint64_t target = (now_ns() - tw->start_ns) / tw->tick_ns;
+  tw_timer pending, *tp;
+  int level, slot, fired = 0;
+
+  while (tw->now <= target) {
+    slot = tw->now & TW_MASK;
+
+    // at the start of each lap, pull the next coarse slot down a level
+    for (level = 1; slot == 0 && level < TW_LEVELS; level++) {
+      slot = (tw->now >> (TW_BITS * level)) & TW_MASK;
+      cascade(tw, level, slot);
+    }
+    slot = tw->now & TW_MASK;
+
+    // detach the slot first: callbacks may re-arm into it
+    list_init(&pending);
+    if (tw->slots[0][slot].next != &tw->slots[0][slot]) {
+      pending.next = tw->slots[0][slot].next;
+      pending.prev = tw->slots[0][slot].prev;
+      pending.next->prev = pending.prev->next = &pending;
+      list_init(&tw->slots[0][slot]);
+    }
+    tw->now++;
+    while (pending.next != &pending) {
+      tp = pending.next;
+      list_del(tp);
+      tw->n_armed--;
+      tp->fn(tp);
+      fired++;
+    }
+  }
+  return fired;
+}
+
+/**
+ * milliseconds until the next tick with work to do, -1 if nothing is armed
+ */
+int tw_timeout_ms(timer_wheel *tw) {
+  uint64_t tick = tw->now, elapsed, due;
+
+  if (tw->n_armed == 0) {
+    return -1;
+  }
+
+  // the nearest non-empty slot, or the next lap start, which may cascade
+  while ((tick & TW_MASK) &&
+         tw->slots[0][tick & TW_MASK].next == &tw->slots[0][tick & TW_MASK]) {
+    tick++;
+  }
+
+  elapsed = now_ns() - tw->start_ns;
+  due = tick * tw->tick_ns; // tick t is processed once t ticks have passed
+  return due <= elapsed ? 0 : (int)((due - elapsed + 999999) / 1000000);
+}
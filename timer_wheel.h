@@ -0,0 +1,64 @@
+#ifndef INCLUDED_TIMER_WHEEL_H
+#define INCLUDED_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Hierarchical timer wheel: TW_LEVELS wheels of TW_SLOTS slots each, the
+ * first one slot per tick, each next one TW_SLOTS times coarser. Arming and
+ * cancelling are O(1) list operations; a timer only moves (cascades) down a
+ * level when its coarse slot comes due.
+ */
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4 // 2^24 ticks: ~46 hours at 10 ms a tick
+
+/**
+ * embed in the object being timed; recover it with tw_entry
+ */
+typedef struct tw_timer {
+  struct tw_timer *next; // links within a slot, NULL when not armed
+  struct tw_timer *prev;
+  uint64_t expires;                 // tick at which it fires
+  void (*fn)(struct tw_timer *tp); // called when it fires
+} tw_timer;
+
+#define tw_entry(tp, type, member)                                            \
+  ((type *)((char *)(tp) - offsetof(type, member)))
+
+typedef struct {
+  uint64_t now;      // next tick to process
+  uint64_t start_ns; // monotonic time of tick 0
+  uint64_t tick_ns;  // length of a tick
+  int n_armed;
+  tw_timer slots[TW_LEVELS][TW_SLOTS]; // circular list heads
+} timer_wheel;
+
+void tw_init(timer_wheel *tw, unsigned tick_ms);
+
+void tw_timer_init(tw_timer *tp, void (*fn)(tw_timer *tp));
+
+/**
+ * (re)arm `tp` to fire in `ms` milliseconds, rounded up to whole ticks
+ */
+void tw_arm(timer_wheel *tw, tw_timer *tp, unsigned ms);
+
+void tw_cancel(timer_wheel *tw, tw_timer *tp);
+
+static inline int tw_armed(const tw_timer *tp) { return tp->next != NULL; }
+
+/**
+ * fire every timer due by now; returns how many fired. Callbacks may arm
+ * or cancel any timer, including their own.
+ */
+int tw_advance(timer_wheel *tw);
+
+/**
+ * milliseconds until the next tick with work to do (a timer or a cascade),
+ * -1 if nothing is armed; suitable as a poll/epoll timeout
+ */
+int tw_timeout_ms(timer_wheel *tw);
+
+#endif
@@ -1,179 +1,273 @@
 /**
  * tiny.c - a simple web server
+ *
+ *   gcc -O2 -pthread -o tiny tiny.c alog.c cgi_pool.c hist.c http_parser.c \
+ *       http_response.c metrics.c rio.c sbuf.c sock.c wpool.c
+ *   gcc -O2 -o cgi-bin/adder cgi-bin/adder.c cgi_pool.c rio.c
+ *   ./tiny -p 64 -w 4 -W /cgi-bin/adder 8000
  */
+#define _GNU_SOURCE
+#include "alog.h"
+#include "cgi_pool.h"
+#include "http_parser.h"
+#include "http_response.h"
+#include "metrics.h"
 #include "rio.h"
+#include "sock.h"
+#include "wpool.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 extern char **environ; /* Defined by libc */
 typedef struct sockaddr SA;
-#define MAXBUF 8192  /* Max I/O buffer size */
-#define LISTENQ 1024 /* Second argument to listen() */
+#define MAXBUF 8192 /* Max I/O buffer size */
+#define STATS_URI "/stats" /* reserved: serves a metrics snapshot */
+#define QUEUE_PER_THREAD 4 /* connections queued per pool thread, at most */
+
+/**
+ * precompressed sidecar files, in order of preference
+ */
+static const struct {
+  const char *coding; // Content-Encoding token
+  const char *suffix; // appended to the file name
+} encodings[] = {
+    {"br", ".br"},
+    {"gzip", ".gz"},
+};
 
 void do_it(int fd);
-void read_requesthdrs(rio_t *rp);
-int parse_uri(char *uri, char *filename, char *cgi_args);
-void serve_static(int fd, char *filename, int filesize);
-void get_filetype(char *filename, char *filetype);
+void serve_request(int fd, const http_request *req);
+void serve_stats(int fd);
+int read_request(int fd, char *buf, size_t max_len, http_request *req);
+int parse_uri(const slice *uri, char *filename, char *cgi_args);
+void serve_static(int fd, char *filename, int filesize,
+                  const http_request *req);
+int get_filetype(char *filename);
 void serve_dynamic(int fd, char *filename, char *cgi_args);
 void client_error(int fd, char *cause, char *err_num, char *short_msg,
                   char *long_msg);
 
-/**
-Establish a connection with a server running on `hostname` and listening for
-connection requests on port number `port`
-*/
-int open_clientfd(char *hostname, char *port) {
-  int clientfd, rc;
-  struct addrinfo hints, *listp, *p;
-
-  // get a list of potential server addresses
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_socktype = SOCK_STREAM; // open a connection
-  hints.ai_flags = AI_NUMERICSERV; // ... using a numeric port arg
-  hints.ai_flags |= AI_ADDRCONFIG; // recommended for connections
-  if ((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0) {
-    fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", hostname, port,
-            gai_strerror(rc));
-    return -2;
-  }
-
-  // walk the list for one that we can successfully connect to
-  for (p = listp; p; p = p->ai_next) {
-    // create socket descriptor
-    if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
-      continue; // socket failed, try next
-    }
+static int cgi_workers = 0; // workers per CGI program, 0 for fork + execve
+static int resolve_names = 0; // log client host names (reverse DNS per accept)
+static cgi_pool cgi_workers_pool;
+static pthread_mutex_t cgi_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int max_threads = 0; // serving threads, sized by load; 0 for none
+static wpool conn_pool;
+static int timeout_ms = 10000; // per request head, and per blocked send
 
-    // connect to server
-    if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) {
-      break; // success
-    }
-    close(clientfd); // connect failed, try another
-  }
-
-  // clean up
-  freeaddrinfo(listp);
-  if (!p) {
-    // _ALL_ connects failed
-    return -1;
+/**
+ * count a response and the bytes it took, or an error if it failed
+ */
+static void count_response(int status, ssize_t sent) {
+  metrics_status(status);
+  if (sent < 0) {
+    metrics_add(METRIC_ERRORS, 1);
   } else {
-    return clientfd;
+    metrics_add(METRIC_BYTES_OUT, sent);
   }
 }
 
 /**
-Return a listening descriptor that is ready to receive connection requests on
-`port`
-*/
-int open_listenfd(char *port) {
-  struct addrinfo hints, *listp, *p;
-  int listenfd, rc, optval = 1;
-
-  // get list of potential server addresses
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_socktype = SOCK_STREAM;             // accept connections
-  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; // ... on any IP addresses
-  hints.ai_flags |= AI_NUMERICSERV;            // ... using port number
-  if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
-    fprintf(stderr, "getaddrinfo failed (port %s): %s\n", port,
-            gai_strerror(rc));
-    return -2;
-  }
-
-  // walk the list for one that we can bind to
-  for (p = listp; p; p = p->ai_next) {
-    // create socket descriptor
-    if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
-      continue; // socket failed, try next
-    }
-
-    // eliminate "address already in use" error from bind
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
-               sizeof(int));
-
-    // bind descriptor to address
-    if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) {
-      break; // success
-    }
-
-    close(listenfd); // bind failed, try next
-  }
-
-  // cleanup
-  freeaddrinfo(listp);
-  if (!p) {
-    return -1;
-  }
+ * bound how long a blocking read or write on `fd` may wait, 0 for forever
+ */
+static void set_timeout(int fd, int optname, long ms) {
+  struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, optname, &tv, sizeof(tv));
+}
 
-  // make it a listening socket ready to accept connection requests
-  if (listen(listenfd, LISTENQ) < 0) {
-    close(listenfd);
-    return -1;
-  }
+/**
+ * one connection, start to finish; on a pool thread with -p
+ */
+static void serve_conn(int fd) {
+  // one stalled client must not hold up everyone queued behind it
+  set_timeout(fd, SO_SNDTIMEO, timeout_ms);
+  do_it(fd);
+  close(fd);
+}
 
-  return listenfd;
+static void usage(char *prog) {
+  fprintf(stderr,
+          "usage: %s [-w cgi_workers [-W /cgi-bin/prog]...] "
+          "[-v off|error|info|debug] [-r] [-t timeout_ms] [-p max_threads] "
+          "<port>\n",
+          prog);
+  exit(1);
 }
 
 int main(int argc, char **argv) {
-  int listenfd, connfd;
+  int listenfd, connfd, opt, log_level = ALOG_INFO;
   char hostname[MAXLINE], port[MAXLINE];
   socklen_t client_len;
   struct sockaddr_storage client_addr;
+  char *pooled[CGI_POOL_MAX_PROGS]; // programs to run in the CGI pool
+  char prog[MAXLINE];
+  int i, n_pooled = 0;
 
   // check command line args
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+  while ((opt = getopt(argc, argv, "w:W:v:rt:p:")) != -1) {
+    switch (opt) {
+    case 'w': // keep a pool of CGI workers instead of forking per request
+      cgi_workers = atoi(optarg);
+      break;
+    case 'W': // a program written for the pool (see cgi_worker_accept)
+      if (n_pooled == CGI_POOL_MAX_PROGS) {
+        usage(argv[0]);
+      }
+      pooled[n_pooled++] = optarg;
+      break;
+    case 'v': // access log level
+      if ((log_level = alog_parse_level(optarg)) < 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 'r': // log host names instead of numeric addresses
+      resolve_names = 1;
+      break;
+    case 't': // drop clients this slow to send a request or take a response
+      timeout_ms = atoi(optarg);
+      break;
+    case 'p': // serve from a pool of threads that grows with the backlog
+      max_threads = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+  alog_init(log_level, STDOUT_FILENO);
+
+  // a client that hangs up mid-response is an EPIPE for its own connection,
+  // not a signal that takes every other connection down with it
+  signal(SIGPIPE, SIG_IGN);
+
+  listenfd = open_listenfd(argv[optind]);
+  // neither CGI children nor pool workers need the listening socket
+  fcntl(listenfd, F_SETFD, FD_CLOEXEC);
+  sock_reserve_spare();
+  if (cgi_workers > 0) {
+    cgi_pool_init(&cgi_workers_pool, cgi_workers);
+    // named as in the URI; parse_uri maps /cgi-bin/x to ./cgi-bin/x
+    for (i = 0; i < n_pooled; i++) {
+      snprintf(prog, sizeof(prog), ".%s", pooled[i]);
+      if (cgi_pool_register(&cgi_workers_pool, prog) < 0) {
+        fprintf(stderr, "could not pool %s\n", pooled[i]);
+      }
+    }
+  }
+  if (max_threads > 0 &&
+      wpool_init(&conn_pool, max_threads * QUEUE_PER_THREAD, 1, max_threads,
+                 serve_conn) < 0) {
+    fprintf(stderr, "could not start %d threads\n", max_threads);
     exit(1);
   }
 
-  listenfd = open_listenfd(argv[1]);
-
   while (1) {
     client_len = sizeof(client_addr);
-    connfd = accept(listenfd, (SA *)&client_addr, &client_len);
-    getnameinfo((SA *)&client_addr, client_len, hostname, MAXLINE, port,
-                MAXLINE, 0);
-    printf("Accepted connection from (%s, %s)\n", hostname, port);
+    // close-on-exec: pool workers spawned while serving must not keep it
+    connfd = accept4(listenfd, (SA *)&client_addr, &client_len, SOCK_CLOEXEC);
+    if (connfd < 0) {
+      // out of descriptors: turn the client away rather than spin
+      if ((errno == EMFILE || errno == ENFILE) && sock_shed(listenfd) == 0) {
+        alog(ALOG_ERROR, "event=reject reason=out_of_fds");
+        metrics_add(METRIC_ERRORS, 1);
+      }
+      continue;
+    }
+    metrics_add(METRIC_CONNS, 1);
+    if (alog_enabled(ALOG_INFO)) {
+      getnameinfo((SA *)&client_addr, client_len, hostname, MAXLINE, port,
+                  MAXLINE, resolve_names ? 0 : NI_NUMERICHOST | NI_NUMERICSERV);
+      alog(ALOG_INFO, "event=accept fd=%d client=%s port=%s", connfd, hostname,
+           port);
+    }
 
-    do_it(connfd);
-    close(connfd);
+    if (max_threads > 0) {
+      wpool_submit(&conn_pool, connfd);
+    } else {
+      serve_conn(connfd);
+    }
   }
 }
 
 void do_it(int fd) {
+  int i, n;
+  char buf[MAXBUF];
+  uint64_t start;
+  http_request req;
+
+  // read request line and headers
+  if ((n = read_request(fd, buf, MAXBUF, &req)) <= 0) {
+    if (n == -2) {
+      alog(ALOG_INFO, "event=timeout fd=%d reason=request", fd);
+      client_error(fd, "request", "408", "Request Timeout",
+                   "Tiny timed out waiting for the request");
+    } else if (n < 0) {
+      client_error(fd, "request", "400", "Bad request",
+                   "Tiny could not parse the request");
+    }
+    return;
+  }
+  metrics_add(METRIC_REQUESTS, 1);
+  metrics_add(METRIC_BYTES_IN, n);
+  alog(ALOG_INFO, "event=request fd=%d method=%.*s uri=%.*s version=%.*s", fd,
+       (int)req.method.len, req.method.p, (int)req.uri.len, req.uri.p,
+       (int)req.version.len, req.version.p);
+  if (alog_enabled(ALOG_DEBUG)) {
+    for (i = 0; i < req.n_headers; i++) {
+      alog(ALOG_DEBUG, "event=header fd=%d name=%.*s value=\"%.*s\"", fd,
+           (int)req.headers[i].name.len, req.headers[i].name.p,
+           (int)req.headers[i].value.len, req.headers[i].value.p);
+    }
+  }
+
+  // service time runs from a complete request head to the response sent
+  start = metrics_now_ns();
+  serve_request(fd, &req);
+  metrics_latency(metrics_now_ns() - start);
+}
+
+/**
+ * answer a parsed request: a file, a CGI program or the stats page
+ */
+void serve_request(int fd, const http_request *req) {
   int is_static;
   struct stat sbuf; // file status
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char filename[MAXLINE], cgi_args[MAXLINE];
-  rio_t rio;
+  char method[16], filename[MAXLINE], cgi_args[MAXLINE];
 
-  // read request line and headers
-  rio_readinitb(&rio, fd);
-  rio_readlineb(&rio, buf, MAXLINE);
-  printf("Request headers: \n");
-  printf("%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version);
-  if (strcasecmp(method, "GET")) {
-    // return non-zero if different
+  if (!slice_caseeq(req->method, "GET")) {
+    snprintf(method, sizeof(method), "%.*s", (int)req->method.len,
+             req->method.p);
     client_error(fd, method, "501", "NOT implemented",
                  "Tiny does not implement this method");
     return;
   }
-  read_requesthdrs(&rio);
+  if (req->uri.len == strlen(STATS_URI) &&
+      !memcmp(req->uri.p, STATS_URI, req->uri.len)) {
+    serve_stats(fd);
+    return;
+  }
 
   // parse URI from GET request
-  is_static = parse_uri(uri, filename, cgi_args);
+  if ((is_static = parse_uri(&req->uri, filename, cgi_args)) < 0) {
+    client_error(fd, "uri", "414", "URI too long",
+                 "Tiny could not handle the request URI");
+    return;
+  }
   if (stat(filename, &sbuf) < 0) {
     client_error(fd, filename, "404", "Not found",
                  "Tiny could not find this file!");
@@ -186,7 +280,7 @@ void do_it(int fd) {
                    "Tiny could not read the file!");
       return;
     }
-    serve_static(fd, filename, sbuf.st_size);
+    serve_static(fd, filename, sbuf.st_size, req);
   } else { /* serve dynamic content */
     if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
       client_error(fd, filename, "403", "Forbidden",
@@ -199,135 +293,312 @@ void do_it(int fd) {
 
 void client_error(int fd, char *cause, char *errnum, char *shortmsg,
                   char *longmsg) {
-  char buf[MAXLINE], body[MAXBUF];
+  char body[MAXBUF];
+  int len;
+  http_resp resp;
+
+  alog(ALOG_INFO, "event=error fd=%d status=%s cause=\"%s\"", fd, errnum,
+       cause);
 
   // build HTTP response body
-  sprintf(body, "<html><title>Tiny Error</title>");
-  sprintf(body,
-          "%s<body bgcolor="
-          "ffffff"
-          ">\r\n",
-          body);
-  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-  sprintf(body, "%s<hr><em>The Tiny Web Server</em>\r\n", body);
-
-  // print HTTP response
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  rio_writen(fd, buf, strlen(buf));
-  rio_writen(fd, body, strlen(body));
+  len = snprintf(body, MAXBUF,
+                 "<html><title>Tiny Error</title><body bgcolor=ffffff>\r\n"
+                 "%s: %s\r\n"
+                 "<p>%s: %s\r\n"
+                 "<hr><em>The Tiny Web Server</em>\r\n",
+                 errnum, shortmsg, longmsg, cause);
+  if (len >= MAXBUF) {
+    len = MAXBUF - 1;
+  }
+
+  // send HTTP response, headers and body in one go
+  http_resp_start(&resp, atoi(errnum));
+  http_resp_content_type(&resp, HTTP_MIME_HTML);
+  http_resp_content_length(&resp, len);
+  count_response(atoi(errnum), http_resp_send(fd, &resp, body, len));
+}
+
+/**
+ * Reads the request line and headers into `buf` and parses them in place.
+ * Returns the length of the request head, 0 if the client went away first,
+ * -1 if the head is malformed or does not fit in `buf`, -2 if it did not
+ * arrive within timeout_ms. The deadline covers the whole head, so a client
+ * trickling it a byte at a time cannot hold the server indefinitely.
+ */
+int read_request(int fd, char *buf, size_t max_len, http_request *req) {
+  size_t len = 0;
+  ssize_t n;
+  int rc;
+  long left_ms = 0;
+  struct timespec now, deadline;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+
+  while (1) {
+    if (timeout_ms > 0) {
+      // each read may only wait for what is left of the deadline
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      left_ms = (deadline.tv_sec - now.tv_sec) * 1000 +
+                (deadline.tv_nsec - now.tv_nsec) / 1000000;
+      if (left_ms <= 0) {
+        return -2;
+      }
+      set_timeout(fd, SO_RCVTIMEO, left_ms);
+    }
+    if ((n = read(fd, buf + len, max_len - 1 - len)) < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return -2;
+    }
+    if (n <= 0) {
+      return 0;
+    }
+    len += n;
+    buf[len] = '\0'; // lets header values be handed to strtod and friends
+    if ((rc = http_parse_request(buf, len, req)) != 0) {
+      return rc;
+    }
+    if (len == max_len - 1) {
+      return -1;
+    }
+  }
 }
 
 /**
- * Reads and _ignores_ request headers
+ * accepts_encoding - does the Accept-Encoding list `accept` allow `coding`?
+ * An entry with q=0 explicitly refuses it; "*" matches any coding.
  */
-void read_requesthdrs(rio_t *rp) {
-  char buf[MAXLINE];
+static int accepts_encoding(const slice *accept, const char *coding) {
+  size_t len, coding_len = strlen(coding);
+  const char *p, *end, *tok, *entry_end, *q;
+  int ok, star = 0;
 
-  rio_readlineb(rp, buf, MAXLINE);
-  while (strcmp(buf, "\r\n")) {
-    rio_readlineb(rp, buf, MAXLINE);
-    printf("%s", buf);
+  if (!accept) {
+    return 0;
   }
-  return;
+  for (p = accept->p, end = p + accept->len; p < end; p = entry_end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+      p++;
+    }
+    for (tok = p; p < end && !strchr(" \t;,", *p); p++) {
+    }
+    len = p - tok;
+    if (!(entry_end = memchr(p, ',', end - p))) {
+      entry_end = end;
+    }
+
+    // a q-value of zero means "not acceptable"
+    ok = 1;
+    for (q = p; q + 1 < entry_end; q++) {
+      if (q[0] == 'q' && q[1] == '=') {
+        ok = strtod(q + 2, NULL) > 0.0;
+        break;
+      }
+    }
+
+    if (len == coding_len && !strncasecmp(tok, coding, len)) {
+      return ok;
+    }
+    if (len == 1 && *tok == '*') {
+      star = ok;
+    }
+  }
+  return star;
 }
 
-int parse_uri(char *uri, char *filename, char *cgi_args) {
+int parse_uri(const slice *uri, char *filename, char *cgi_args) {
   // Assuming home dir for static content is current dir
   // home dir for executable is ./cgi-bin
   // default file name is ./home.html
-  char *ptr;
-
-  // strstr: find first occurrence of null-terminated string in the
-  // null-terminated string
-  if (!strstr(uri, "cgi-bin")) { /* static content */
-    strcpy(cgi_args, "");
-    strcpy(filename, ".");
-    strcat(filename, uri); // append uri to . => ./index.html
-    if (uri[strlen(uri) - 1] == '/') {
+  const char *ptr;
+  size_t path_len = uri->len;
+
+  if (uri->len + sizeof("./home.html") > MAXLINE) {
+    return -1;
+  }
+
+  if (!memmem(uri->p, uri->len, "cgi-bin", 7)) { /* static content */
+    cgi_args[0] = '\0';
+    filename[0] = '.';
+    memcpy(filename + 1, uri->p, uri->len); // append uri to . => ./index.html
+    filename[uri->len + 1] = '\0';
+    if (uri->len == 0 || uri->p[uri->len - 1] == '/') {
       strcat(filename, "home.html"); // default file name
     }
     return 1;
   } else { /* dynamic content */
-    ptr = index(uri, '?');
+    ptr = memchr(uri->p, '?', uri->len);
     if (ptr) {
-      strcpy(cgi_args, ptr + 1);
-      *ptr = '\0';
+      path_len = ptr - uri->p;
+      memcpy(cgi_args, ptr + 1, uri->len - path_len - 1);
+      cgi_args[uri->len - path_len - 1] = '\0';
     } else {
-      strcpy(cgi_args, "");
+      cgi_args[0] = '\0';
     }
 
-    strcpy(filename, ".");
-    strcat(filename, uri);
+    filename[0] = '.';
+    memcpy(filename + 1, uri->p, path_len);
+    filename[path_len + 1] = '\0';
     return 0;
   }
 }
 
-void serve_static(int fd, char *filename, int filesize) {
-  int src_fd;
-  char *srcp, filetype[MAXLINE], buf[MAXLINE];
+/**
+ * choose_variant - pick a precompressed sidecar of `filename` the client
+ * accepts. On success `variant` names the sidecar, `*size` is its size and the
+ * coding is returned; otherwise NULL. `*has_variants` is set if any sidecar
+ * exists, so the response can carry Vary either way.
+ */
+static const char *choose_variant(char *filename, const http_request *req,
+                                  char *variant, int *size,
+                                  int *has_variants) {
+  struct stat sbuf;
+  const slice *accept = http_find_header(req, "Accept-Encoding");
+  const char *chosen = NULL;
+  size_t i;
+
+  *has_variants = 0;
+  for (i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++) {
+    char path[MAXLINE];
+    if (snprintf(path, MAXLINE, "%s%s", filename, encodings[i].suffix) >=
+            MAXLINE ||
+        stat(path, &sbuf) < 0 || !S_ISREG(sbuf.st_mode) ||
+        !(S_IRUSR & sbuf.st_mode)) {
+      continue;
+    }
+    *has_variants = 1;
+    if (!chosen && accepts_encoding(accept, encodings[i].coding)) {
+      chosen = encodings[i].coding;
+      strcpy(variant, path);
+      *size = sbuf.st_size;
+    }
+  }
+  return chosen;
+}
 
-  // send response headers to client
-  get_filetype(filename, filetype);
+void serve_static(int fd, char *filename, int filesize,
+                  const http_request *req) {
+  int src_fd, has_variants, filetype;
+  char variant[MAXLINE];
+  const char *coding;
+  http_resp resp;
+
+  // the type is that of the original file, whatever variant is sent
+  filetype = get_filetype(filename);
+  if ((coding = choose_variant(filename, req, variant, &filesize,
+                               &has_variants))) {
+    filename = variant;
+  }
+  // close-on-exec: another thread may be forking a CGI program right now
+  if ((src_fd = open(filename, O_RDONLY | O_CLOEXEC, 0)) < 0) {
+    client_error(fd, filename, "403", "Forbidden",
+                 "Tiny could not read the file!");
+    return;
+  }
 
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-  sprintf(buf, "%sConnection: close\r\n", buf);
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
+  // send response headers and body to client
+  // sendfile copies straight from the page cache, with no mapping or buffer
+  http_resp_start(&resp, 200);
+  http_resp_lit(&resp, "Connection: close\r\n");
+  http_resp_content_length(&resp, filesize);
+  if (coding) {
+    http_resp_header(&resp, "Content-encoding", coding);
+  }
+  if (has_variants) {
+    http_resp_lit(&resp, "Vary: Accept-Encoding\r\n");
+  }
+  http_resp_content_type(&resp, filetype);
+  if (resp.truncated) { /* a header was dropped: don't send it without */
+    close(src_fd);
+    client_error(fd, filename, "500", "Internal server error",
+                 "Tiny's response headers did not fit");
+    return;
+  }
+  count_response(200, http_resp_sendfile(fd, &resp, src_fd, filesize));
+  close(src_fd);
 
-  rio_writen(fd, buf, strlen(buf));
-  printf("Response headers: \n");
-  printf("%s", buf);
+  alog(ALOG_DEBUG,
+       "event=response fd=%d status=200 length=%d type=%s encoding=%s", fd,
+       filesize, http_mime_types[filetype], coding ? coding : "identity");
+}
 
-  // send response body to client
-  src_fd = open(filename, O_RDONLY, 0);
+/**
+ * serve_stats - the metrics of every thread, summed, as plain text
+ */
+void serve_stats(int fd) {
+  metrics_snapshot *snap = malloc(sizeof(metrics_snapshot));
+  char body[MAXBUF];
+  size_t len;
+  http_resp resp;
+
+  if (!snap) {
+    client_error(fd, "stats", "500", "Internal server error",
+                 "Tiny could not take a snapshot");
+    return;
+  }
+  metrics_snapshot_take(snap);
+  if ((len = metrics_format(snap, body, sizeof(body))) >= sizeof(body)) {
+    len = sizeof(body) - 1;
+  }
+  free(snap);
 
-  // mmap creates a new mapping in virtual addr space of the calling process
-  // starting addr for new mapping is the first arg
-  // if addr is NULL, then kernel chooses the (page-aligned) addr to create the
-  // mapping
-  srcp = mmap(0, filesize, PROT_READ, MAP_PRIVATE, src_fd, 0);
-  close(src_fd);
-  rio_writen(fd, srcp, filesize);
-  munmap(srcp, filesize);
+  http_resp_start(&resp, 200);
+  http_resp_lit(&resp, "Cache-Control: no-store\r\n");
+  http_resp_content_type(&resp, HTTP_MIME_TEXT);
+  http_resp_content_length(&resp, len);
+  count_response(200, http_resp_send(fd, &resp, body, len));
 }
 
 /**
- * get_filetype - derive file type from filename
+ * get_filetype - derive file type (an http_mime_types index) from filename
  */
-void get_filetype(char *filename, char *filetype) {
-  if (strstr(filename, ".html")) {
-    strcpy(filetype, "text/html");
-  } else if (strstr(filename, ".gif")) {
-    strcpy(filetype, "image/gif");
-  } else if (strstr(filename, ".png")) {
-    strcpy(filetype, "image/png");
-  } else if (strstr(filename, ".jpg")) {
-    strcpy(filetype, "image/jpeg");
-  } else {
-    strcpy(filetype, "text/plain");
-  }
+int get_filetype(char *filename) {
+  return http_mime_lookup(filename, strlen(filename));
 }
 
 void serve_dynamic(int fd, char *filename, char *cgi_args) {
-  char buf[MAXLINE], *empty_list[] = {NULL};
-
-  // return first part of HTTP response
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Server: Tiny Web Server\r\n");
-  rio_writen(fd, buf, strlen(buf));
+  char *empty_list[] = {NULL};
+  int dispatched;
+  pid_t pid;
+  http_resp resp;
+
+  // first part of the HTTP response; the CGI program adds the rest. It is
+  // sent by whoever runs the program, so until one does an error can still
+  // be reported
+  http_resp_start(&resp, 200);
+
+  // a pool worker answers on its own; tiny moves on without waiting
+  if (cgi_workers > 0) {
+    pthread_mutex_lock(&cgi_pool_lock); // the pool is not thread-safe
+    dispatched = cgi_pool_dispatch(&cgi_workers_pool, filename, cgi_args,
+                                   resp.buf, resp.len, fd);
+    pthread_mutex_unlock(&cgi_pool_lock);
+    if (dispatched == 0) {
+      count_response(200, resp.len);
+      return;
+    }
+  }
 
-  if (fork() == 0) { /* child */
+  if ((pid = fork()) < 0) {
+    client_error(fd, filename, "500", "Internal server error",
+                 "Tiny could not run the CGI program");
+    return;
+  }
+  if (pid == 0) { /* child */
+    if (http_resp_send_head(fd, &resp) < 0) {
+      _exit(1);
+    }
+    signal(SIGPIPE, SIG_DFL); // ignoring it would survive execve
     // real server would set all CGI vars here
     setenv("QUERY_STRING", cgi_args, 1);
     dup2(fd, STDOUT_FILENO);               // redirect stdout to client
     execve(filename, empty_list, environ); // run CGI program
+    _exit(1);
   }
-  wait(NULL); // parent waits for and reaps child
+  count_response(200, resp.len);
+  // parent waits for and reaps this child, never a pool worker
+  waitpid(pid, NULL, 0);
 }
@@ -0,0 +1,182 @@
+/**
+ * A worker pool grown and shrunk by how full its queue stays
+ */
+#include "wpool.h"
+#include "metrics.h"
+#include <time.h>
+
+#define WPOOL_TICK_MS 100       /* how often the controller samples */
+#define WPOOL_GROW_TICKS 2      /* busy ticks in a row before growing */
+#define WPOOL_SHRINK_TICKS 30   /* idle ticks in a row before retiring one */
+#define WPOOL_MAX_DELAY_MS 50   /* queueing this long counts as busy */
+#define WPOOL_RETIRE -1         /* item that tells a worker to exit */
+
+/**
+ * record how long a job sat in the queue, keeping the tick's maximum
+ */
+static void note_delay(wpool *wp, uint64_t delay) {
+  unsigned long long seen = atomic_load_explicit(&wp->max_delay_ns,
+                                                 memory_order_relaxed);
+
+  while (delay > seen &&
+         !atomic_compare_exchange_weak_explicit(&wp->max_delay_ns, &seen,
+                                                delay, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+static void *worker_thread(void *vargp) {
+  wpool *wp = vargp;
+  wpool_job job;
+
+  while (1) {
+    sbuf_remove_n(&wp->queue, &job, 1);
+    if (job.item == WPOOL_RETIRE) {
+      break;
+    }
+    note_delay(wp, metrics_now_ns() - job.queued_ns);
+    atomic_fetch_add_explicit(&wp->n_busy, 1, memory_order_relaxed);
+    wp->handle(job.item);
+    atomic_fetch_sub_explicit(&wp->n_busy, 1, memory_order_relaxed);
+  }
+
+  pthread_mutex_lock(&wp->lock);
+  atomic_fetch_sub(&wp->n_workers, 1);
+  pthread_cond_broadcast(&wp->exited);
+  pthread_mutex_unlock(&wp->lock);
+  return NULL;
+}
+
+/**
+ * start up to `n` more workers; returns how many started
+ */
+static int add_workers(wpool *wp, int n) {
+  pthread_attr_t attr;
+  pthread_t tid;
+  int i;
+
+  // workers retire on their own, so nobody joins them
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_mutex_lock(&wp->lock);
+  for (i = 0; i < n; i++) {
+    if (pthread_create(&tid, &attr, worker_thread, wp) != 0) {
+      break;
+    }
+    atomic_fetch_add(&wp->n_workers, 1);
+  }
+  pthread_mutex_unlock(&wp->lock);
+  pthread_attr_destroy(&attr);
+  return i;
+}
+
+/**
+ * sample the queue every tick and resize the pool. Thresholds are
+ * asymmetric (nearly full to grow, empty to shrink) and must hold for
+ * several ticks, so the pool settles instead of flapping.
+ */
+static void *controller_thread(void *vargp) {
+  wpool *wp = vargp;
+  struct timespec tick = {0, WPOOL_TICK_MS * 1000000L};
+  wpool_job retire = {WPOOL_RETIRE, 0};
+  int depth, n, busy, grow, hot = 0, cold = 0;
+  uint64_t delay;
+
+  while (!atomic_load(&wp->stopping)) {
+    nanosleep(&tick, NULL);
+    depth = sbuf_count(&wp->queue);
+    delay = atomic_exchange_explicit(&wp->max_delay_ns, 0,
+                                     memory_order_relaxed);
+    n = atomic_load(&wp->n_workers);
+    busy = atomic_load_explicit(&wp->n_busy, memory_order_relaxed);
+
+    metrics_set(METRIC_GAUGE_WORKERS, n);
+    metrics_set(METRIC_GAUGE_BUSY, busy);
+    metrics_set(METRIC_GAUGE_QUEUE_DEPTH, depth);
+    metrics_set(METRIC_GAUGE_QUEUE_DELAY_US, delay / 1000);
+
+    // saturated: nearly full, items waiting on all-busy workers, or waits
+    // already too long (seen only as items are taken, hence the others)
+    hot = (depth * 4 >= wp->queue.n * 3 || (depth > 0 && busy >= n) ||
+           delay >= WPOOL_MAX_DELAY_MS * 1000000ULL)
+              ? hot + 1
+              : 0;
+    cold = (depth == 0 && busy < n) ? cold + 1 : 0;
+
+    if (hot >= WPOOL_GROW_TICKS && n < wp->max_workers) {
+      // half again as many, so a big backlog is met in a few steps
+      grow = (n / 2 > 1) ? n / 2 : 1;
+      add_workers(wp, (grow < wp->max_workers - n) ? grow
+                                                    : wp->max_workers - n);
+      hot = 0;
+    } else if (cold >= WPOOL_SHRINK_TICKS && n > wp->min_workers) {
+      // whichever worker is idle takes it; one per interval
+      sbuf_try_insert_n(&wp->queue, &retire, 1);
+      cold = 0;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * start `min_workers` workers, queueing up to `slots` items, and the
+ * controller; -1 on failure
+ */
+int wpool_init(wpool *wp, int slots, int min_workers, int max_workers,
+               void (*handle)(int item)) {
+  if (min_workers < 1 || max_workers < min_workers ||
+      sbuf_init_kind(&wp->queue, slots, SBUF_MPMC, sizeof(wpool_job)) < 0) {
+    return -1;
+  }
+  wp->handle = handle;
+  wp->min_workers = min_workers;
+  wp->max_workers = max_workers;
+  pthread_mutex_init(&wp->lock, NULL);
+  pthread_cond_init(&wp->exited, NULL);
+  atomic_init(&wp->n_workers, 0);
+  atomic_init(&wp->n_busy, 0);
+  atomic_init(&wp->max_delay_ns, 0);
+  atomic_init(&wp->stopping, 0);
+
+  if (add_workers(wp, min_workers) == 0 ||
+      pthread_create(&wp->controller, NULL, controller_thread, wp) != 0) {
+    atomic_store(&wp->stopping, 1); // no controller to join
+    wpool_deinit(wp);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * run handle(item) on some worker, waiting while the queue is full;
+ * `item` must not be negative
+ */
+void wpool_submit(wpool *wp, int item) {
+  wpool_job job = {item, metrics_now_ns()};
+
+  sbuf_insert_n(&wp->queue, &job, 1);
+}
+
+/**
+ * let the workers finish what is queued, then stop them and the controller
+ */
+void wpool_deinit(wpool *wp) {
+  wpool_job retire = {WPOOL_RETIRE, 0};
+  int i, n;
+
+  if (!atomic_exchange(&wp->stopping, 1)) {
+    pthread_join(wp->controller, NULL);
+  }
+  n = atomic_load(&wp->n_workers);
+  for (i = 0; i < n; i++) {
+    sbuf_insert_n(&wp->queue, &retire, 1);
+  }
+  pthread_mutex_lock(&wp->lock);
+  while (atomic_load(&wp->n_workers) > 0) {
+    pthread_cond_wait(&wp->exited, &wp->lock);
+  }
+  pthread_mutex_unlock(&wp->lock);
+  pthread_mutex_destroy(&wp->lock);
+  pthread_cond_destroy(&wp->exited);
+  sbuf_deinit(&wp->queue);
+}
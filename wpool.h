@@ -0,0 +1,54 @@
+#ifndef INCLUDED_WPOOL_H
+#define INCLUDED_WPOOL_H
+
+#include "sbuf.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Worker pool that sizes itself. Items (connected fds, say) wait in an sbuf
+ * for one of the workers; a controller thread samples the queue every tick
+ * and adds workers, up to a cap, while it stays nearly full or items wait
+ * too long, and retires them one at a time while it stays empty. Growing
+ * takes a couple of ticks and shrinking seconds, so a burst does not make
+ * the pool flap.
+ */
+
+typedef struct {
+  int item;           // handed to the handler
+  uint64_t queued_ns; // when it was submitted
+} wpool_job;
+
+typedef struct {
+  sbuf_t queue; // of wpool_job
+  void (*handle)(int item);
+  int min_workers, max_workers;
+  pthread_mutex_t lock; // protects n_workers changes
+  pthread_cond_t exited;
+  atomic_int n_workers;          // running, including any told to retire
+  atomic_int n_busy;             // running the handler
+  atomic_ullong max_delay_ns;    // longest wait in the queue this tick
+  atomic_int stopping;
+  pthread_t controller;
+} wpool;
+
+/**
+ * start `min_workers` workers, queueing up to `slots` items, and the
+ * controller; -1 on failure
+ */
+int wpool_init(wpool *wp, int slots, int min_workers, int max_workers,
+               void (*handle)(int item));
+
+/**
+ * run handle(item) on some worker, waiting while the queue is full;
+ * `item` must not be negative
+ */
+void wpool_submit(wpool *wp, int item);
+
+/**
+ * let the workers finish what is queued, then stop them and the controller
+ */
+void wpool_deinit(wpool *wp);
+
+#endif
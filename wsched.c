@@ -0,0 +1,319 @@
+/**
+ * A work-stealing scheduler over per-worker Chase-Lev deques
+ */
+#include "wsched.h"
+#include "futex.h"
+#include <stdlib.h>
+
+#define WS_DEQUE_INIT 256    /* initial deque size, grown by doubling */
+#define WS_INJECT_SLOTS 4096 /* tasks submitted from outside, in flight */
+#define WS_SPINS 64          /* fruitless rounds before a worker parks */
+#define WS_INJECT_BATCH 32   /* outside submissions taken at once */
+
+static __thread ws_worker *self; // the worker running on this thread
+
+static ws_array *array_new(long size, ws_array *prev) {
+  ws_array *a = malloc(sizeof(ws_array) + size * sizeof(ws_task *));
+
+  if (a) {
+    a->size = size;
+    a->prev = prev;
+  }
+  return a;
+}
+
+/**
+ * owner: double the array, copying the live range [t, b)
+ */
+static ws_array *deque_grow(ws_deque *dq, ws_array *a, long t, long b) {
+  ws_array *bigger = array_new(a->size * 2, a);
+  long i;
+
+  if (!bigger) {
+    return NULL;
+  }
+  for (i = t; i < b; i++) {
+    atomic_store_explicit(
+        &bigger->tasks[i & (bigger->size - 1)],
+        atomic_load_explicit(&a->tasks[i & (a->size - 1)],
+                             memory_order_relaxed),
+        memory_order_relaxed);
+  }
+  atomic_store_explicit(&dq->array, bigger, memory_order_release);
+  return bigger;
+}
+
+/**
+ * owner: push at the bottom; -1 if the deque could not grow
+ */
+static int deque_push(ws_deque *dq, ws_task *tp) {
+  long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+  ws_array *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+  if (b - t > a->size - 1 && !(a = deque_grow(dq, a, t, b))) {
+    return -1;
+  }
+  atomic_store_explicit(&a->tasks[b & (a->size - 1)], tp,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+  return 0;
+}
+
+/**
+ * owner: pop the newest task, racing thieves only for the last one
+ */
+static ws_task *deque_take(ws_deque *dq) {
+  long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+  ws_array *a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+  ws_task *tp = NULL;
+  long t;
+
+  atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+  if (t <= b) {
+    tp = atomic_load_explicit(&a->tasks[b & (a->size - 1)],
+                              memory_order_relaxed);
+    if (t == b) { /* the last one: whoever moves top first gets it */
+      if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed)) {
+        tp = NULL;
+      }
+      atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+  } else { /* empty */
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+  }
+  return tp;
+}
+
+/**
+ * thief: take the oldest task; NULL if empty or another thread won it
+ */
+static ws_task *deque_steal(ws_deque *dq) {
+  long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+  long b;
+  ws_array *a;
+  ws_task *tp;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+  if (t >= b) {
+    return NULL;
+  }
+  a = atomic_load_explicit(&dq->array, memory_order_acquire);
+  tp = atomic_load_explicit(&a->tasks[t & (a->size - 1)],
+                            memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return NULL;
+  }
+  return tp;
+}
+
+static int deque_empty(ws_deque *dq) {
+  return atomic_load_explicit(&dq->top, memory_order_acquire) >=
+         atomic_load_explicit(&dq->bottom, memory_order_acquire);
+}
+
+/**
+ * after new work is visible: wake one parked worker, if any. The fence
+ * pairs with the one in park: either we see it parked, or it sees the work.
+ */
+static void unpark_one(wsched *ws) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ws->n_parked, memory_order_relaxed)) {
+    atomic_fetch_add(&ws->park_futex, 1);
+    futex_wake(&ws->park_futex, 1);
+  }
+}
+
+static void run_task(wsched *ws, ws_task *tp) {
+  tp->fn(tp);
+  if (atomic_fetch_sub(&ws->pending, 1) == 1) { /* the pool went idle */
+    atomic_fetch_add(&ws->idle_futex, 1);
+    futex_wake(&ws->idle_futex, 1 << 30);
+  }
+}
+
+/**
+ * next task for worker `w`: its own newest, then outside submissions, then
+ * the oldest of a few random victims'
+ */
+static ws_task *find_task(wsched *ws, ws_worker *w) {
+  ws_task *tp, *batch[WS_INJECT_BATCH];
+  int i, n, victim;
+
+  if ((tp = deque_take(&w->deque))) {
+    return tp;
+  }
+  // one claim for a batch; the rest go on our deque, where others can steal
+  if ((n = sbuf_try_remove_n(&ws->inject, batch, WS_INJECT_BATCH)) > 0) {
+    for (i = n - 1; i > 0; i--) {
+      if (deque_push(&w->deque, batch[i]) < 0 &&
+          sbuf_try_insert_n(&ws->inject, &batch[i], 1) == 0) {
+        run_task(ws, batch[i]); /* nowhere to put it: never block on it */
+      }
+    }
+    if (n > 1) {
+      unpark_one(ws);
+    }
+    return batch[0];
+  }
+  for (i = 0; i < ws->n_workers; i++) {
+    victim = rand_r(&w->seed) % ws->n_workers;
+    if (victim != w->id && (tp = deque_steal(&ws->workers[victim].deque))) {
+      return tp;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * is there work anywhere a parking worker could miss?
+ */
+static int work_visible(wsched *ws) {
+  int i;
+
+  if (atomic_load_explicit(&ws->inject.tail, memory_order_acquire) !=
+      atomic_load_explicit(&ws->inject.head, memory_order_acquire)) {
+    return 1;
+  }
+  for (i = 0; i < ws->n_workers; i++) {
+    if (!deque_empty(&ws->workers[i].deque)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * sleep until new work or shutdown bumps the futex
+ */
+static void park(wsched *ws) {
+  unsigned seen = atomic_load(&ws->park_futex);
+
+  atomic_fetch_add(&ws->n_parked, 1);
+  atomic_thread_fence(memory_order_seq_cst); /* pairs with unpark_one */
+  if (!work_visible(ws) && !atomic_load(&ws->stopping)) {
+    futex_wait(&ws->park_futex, seen);
+  }
+  atomic_fetch_sub(&ws->n_parked, 1);
+}
+
+static void *worker_thread(void *vargp) {
+  ws_worker *w = vargp;
+  wsched *ws = w->ws;
+  ws_task *tp;
+  int spins = 0;
+
+  self = w;
+  while (!atomic_load_explicit(&ws->stopping, memory_order_relaxed)) {
+    if ((tp = find_task(ws, w))) {
+      run_task(ws, tp);
+      spins = 0;
+    } else if (++spins < WS_SPINS) {
+      cpu_relax();
+    } else {
+      park(ws);
+      spins = 0;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * start `n_workers` worker threads; -1 on failure
+ */
+int wsched_init(wsched *ws, int n_workers) {
+  int i;
+
+  ws->n_workers = n_workers;
+  atomic_init(&ws->pending, 0);
+  atomic_init(&ws->park_futex, 0);
+  atomic_init(&ws->n_parked, 0);
+  atomic_init(&ws->idle_futex, 0);
+  atomic_init(&ws->stopping, 0);
+  if (n_workers < 1 ||
+      sbuf_init_kind(&ws->inject, WS_INJECT_SLOTS, SBUF_MPMC,
+                     sizeof(ws_task *)) < 0) {
+    return -1;
+  }
+  if (!(ws->workers = aligned_alloc(64, n_workers * sizeof(ws_worker)))) {
+    sbuf_deinit(&ws->inject);
+    return -1;
+  }
+  for (i = 0; i < n_workers; i++) {
+    ws->workers[i].ws = ws;
+    ws->workers[i].id = i;
+    ws->workers[i].seed = i + 1;
+    atomic_init(&ws->workers[i].deque.top, 0);
+    atomic_init(&ws->workers[i].deque.bottom, 0);
+    atomic_init(&ws->workers[i].deque.array, array_new(WS_DEQUE_INIT, NULL));
+  }
+  for (i = 0; i < n_workers; i++) {
+    pthread_create(&ws->workers[i].tid, NULL, worker_thread, &ws->workers[i]);
+  }
+  return 0;
+}
+
+/**
+ * stop the workers and free everything; tasks still queued are dropped,
+ * so call wsched_wait first
+ */
+void wsched_deinit(wsched *ws) {
+  ws_array *a, *prev;
+  int i;
+
+  atomic_store(&ws->stopping, 1);
+  atomic_fetch_add(&ws->park_futex, 1);
+  futex_wake(&ws->park_futex, 1 << 30);
+  for (i = 0; i < ws->n_workers; i++) {
+    pthread_join(ws->workers[i].tid, NULL);
+  }
+  for (i = 0; i < ws->n_workers; i++) {
+    for (a = atomic_load(&ws->workers[i].deque.array); a; a = prev) {
+      prev = a->prev;
+      free(a);
+    }
+  }
+  free(ws->workers);
+  sbuf_deinit(&ws->inject);
+}
+
+/**
+ * run `tp` on some worker; from inside a task it goes on the caller's own
+ * deque, or runs at once if nothing has room
+ */
+void wsched_submit(wsched *ws, ws_task *tp) {
+  atomic_fetch_add(&ws->pending, 1);
+  if (!self || self->ws != ws) {
+    sbuf_insert_n(&ws->inject, &tp, 1); /* the workers will drain it */
+  } else if (deque_push(&self->deque, tp) < 0 &&
+             sbuf_try_insert_n(&ws->inject, &tp, 1) == 0) {
+    // a worker waiting on a full inject queue could wait on itself, so
+    // it runs the task here instead
+    run_task(ws, tp);
+    return;
+  }
+  unpark_one(ws);
+}
+
+/**
+ * wait until every submitted task has finished
+ */
+void wsched_wait(wsched *ws) {
+  unsigned seen;
+
+  while (1) {
+    seen = atomic_load(&ws->idle_futex);
+    if (atomic_load(&ws->pending) == 0) {
+      return;
+    }
+    futex_wait(&ws->idle_futex, seen);
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef INCLUDED_WSCHED_H
+#define INCLUDED_WSCHED_H
+
+#include "sbuf.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * Work-stealing task scheduler. Each worker keeps its own Chase-Lev deque:
+ * it pushes and pops at the bottom without contention, while idle workers
+ * steal single tasks from the top of a random victim's deque. Tasks
+ * submitted from outside the pool go through a shared injection queue.
+ * Workers that find nothing anywhere park on a futex until work arrives.
+ */
+
+/**
+ * embed in the object to run; recover it with ws_entry. A task may be
+ * resubmitted once its fn has started.
+ */
+typedef struct ws_task {
+  void (*fn)(struct ws_task *tp);
+} ws_task;
+
+#define ws_entry(tp, type, member)                                            \
+  ((type *)((char *)(tp) - offsetof(type, member)))
+
+/**
+ * growable circular array of task pointers; old ones are kept until
+ * wsched_deinit since a thief may still be reading them
+ */
+typedef struct ws_array {
+  long size; // a power of two
+  struct ws_array *prev;
+  _Atomic(ws_task *) tasks[];
+} ws_array;
+
+typedef struct {
+  _Alignas(64) atomic_long top;  // next task to steal
+  _Alignas(64) atomic_long bottom; // next free slot, owner only
+  _Atomic(ws_array *) array;
+} ws_deque;
+
+struct wsched;
+
+typedef struct {
+  ws_deque deque;
+  struct wsched *ws;
+  pthread_t tid;
+  int id;
+  unsigned seed; // for picking victims
+} ws_worker;
+
+typedef struct wsched {
+  int n_workers;
+  ws_worker *workers;
+  sbuf_t inject; // tasks submitted from outside the pool (SBUF_MPMC)
+  _Alignas(64) atomic_long pending; // submitted but not yet finished
+  _Alignas(64) atomic_uint park_futex; // bumped to wake parked workers
+  atomic_int n_parked;
+  atomic_uint idle_futex; // bumped when pending drops to 0
+  atomic_int stopping;
+} wsched;
+
+/**
+ * start `n_workers` worker threads; -1 on failure
+ */
+int wsched_init(wsched *ws, int n_workers);
+
+/**
+ * stop the workers and free everything; tasks still queued are dropped,
+ * so call wsched_wait first
+ */
+void wsched_deinit(wsched *ws);
+
+static inline void ws_task_init(ws_task *tp, void (*fn)(ws_task *tp)) {
+  tp->fn = fn;
+}
+
+/**
+ * run `tp` on some worker; from inside a task it goes on the caller's own
+ * deque (most recent first, so splitting a job keeps its data warm), or,
+ * if that cannot grow and the injection queue is full, runs at once
+ */
+void wsched_submit(wsched *ws, ws_task *tp);
+
+/**
+ * wait until every submitted task, including those they submitted, has
+ * finished
+ */
+void wsched_wait(wsched *ws);
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * wsched_bench.c - skewed workload through the work-stealing scheduler and
+ * through a pool of threads sharing one sbuf
+ *
+ *   gcc -O2 -pthread -o wsched_bench wsched_bench.c wsched.c sbuf.c
+ *   ./wsched_bench [threads] [requests] [big_every]
+ *
+ * Most requests cost one unit of work (about a microsecond); every
+ * `big_every`-th one is a "big static file" of BIG_UNITS units, which splits
+ * itself into CHUNK_UNITS-sized chunk tasks so other workers can help.
+ */
+#include "wsched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BIG_UNITS 4096
+#define CHUNK_UNITS 64
+#define UNIT_SPINS 1000 /* about a microsecond */
+
+typedef struct {
+  ws_task task;
+  int units;  // work; over CHUNK_UNITS means split into chunks
+  ws_task *chunks;
+} request;
+
+/**
+ * one worker thread's tally, on its own cache line so counting doesn't add
+ * the cross-core traffic the pools are being compared on
+ */
+typedef struct {
+  _Alignas(64) atomic_long done; // units finished, written by its owner only
+  unsigned sink;                 // keeps the work from being optimized out
+} tally;
+
+static void (*submit)(ws_task *tp); // of the pool being measured
+static tally tallies[256];          // one per worker thread of this run
+static atomic_int n_tallies;
+static __thread tally *my_tally;
+
+static wsched sched;
+static sbuf_t shared;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void work(int units) {
+  tally *t = my_tally;
+  unsigned x;
+  int i;
+
+  if (!t) {
+    t = my_tally = &tallies[atomic_fetch_add(&n_tallies, 1)];
+  }
+  for (i = 0, x = t->sink; i < units * UNIT_SPINS; i++) {
+    x = x * 1664525 + 1013904223;
+  }
+  t->sink = x;
+  atomic_store_explicit(
+      &t->done, atomic_load_explicit(&t->done, memory_order_relaxed) + units,
+      memory_order_relaxed);
+}
+
+/**
+ * units finished so far, across every worker
+ */
+static long units_done(void) {
+  long sum = 0;
+  int i, n = atomic_load(&n_tallies);
+
+  for (i = 0; i < n; i++) {
+    sum += atomic_load_explicit(&tallies[i].done, memory_order_relaxed);
+  }
+  return sum;
+}
+
+static void run_chunk(ws_task *tp) {
+  (void)tp;
+  work(CHUNK_UNITS);
+}
+
+static void run_request(ws_task *tp) {
+  request *r = ws_entry(tp, request, task);
+  int i;
+
+  if (r->units <= CHUNK_UNITS) {
+    work(r->units);
+    return;
+  }
+  for (i = 0; i < r->units / CHUNK_UNITS; i++) {
+    submit(&r->chunks[i]);
+  }
+}
+
+static void wsched_submit_one(ws_task *tp) {
+  wsched_submit(&sched, tp);
+}
+
+static void shared_submit_one(ws_task *tp) {
+  sbuf_insert_n(&shared, &tp, 1);
+}
+
+static void *shared_worker(void *vargp) {
+  ws_task *tp;
+
+  (void)vargp;
+  while (sbuf_remove_n(&shared, &tp, 1) == 1 && tp) {
+    tp->fn(tp);
+  }
+  return NULL;
+}
+
+/**
+ * one run; "wsched" or a shared sbuf of `kind`. Returns elapsed seconds,
+ * or -1 if units were lost.
+ */
+static double run(int kind, int threads, request *reqs, int n, long total) {
+  pthread_t tids[256];
+  ws_task *stop = NULL;
+  double t0, elapsed;
+  int i;
+
+  // fresh threads every run, each claiming a tally on its first task
+  memset(tallies, 0, sizeof(tallies));
+  atomic_store(&n_tallies, 0);
+  if (kind < 0) {
+    submit = wsched_submit_one;
+    wsched_init(&sched, threads);
+  } else {
+    submit = shared_submit_one;
+    // room for every task at once: workers also insert, and must not block
+    sbuf_init_kind(&shared, n + total / CHUNK_UNITS, kind, sizeof(ws_task *));
+    for (i = 0; i < threads; i++) {
+      pthread_create(&tids[i], NULL, shared_worker, NULL);
+    }
+  }
+
+  t0 = now_sec();
+  for (i = 0; i < n; i++) {
+    submit(&reqs[i].task);
+  }
+  if (kind < 0) {
+    wsched_wait(&sched);
+  } else {
+    while (units_done() < total) {
+      nanosleep(&(struct timespec){0, 100000}, NULL);
+    }
+  }
+  elapsed = now_sec() - t0;
+
+  if (kind < 0) {
+    wsched_deinit(&sched);
+  } else {
+    for (i = 0; i < threads; i++) {
+      sbuf_insert_n(&shared, &stop, 1);
+    }
+    for (i = 0; i < threads; i++) {
+      pthread_join(tids[i], NULL);
+    }
+    sbuf_deinit(&shared);
+  }
+  return (units_done() == total) ? elapsed : -1;
+}
+
+int main(int argc, char **argv) {
+  int threads = (argc > 1) ? atoi(argv[1]) : 4;
+  int n = (argc > 2) ? atoi(argv[2]) : 200000;
+  int big_every = (argc > 3) ? atoi(argv[3]) : 1000;
+  const char *names[] = {"wsched", "sbuf locked", "sbuf mpmc"};
+  int kinds[] = {-1, SBUF_LOCKED, SBUF_MPMC};
+  request *reqs;
+  long total = 0;
+  double secs;
+  int i, k;
+
+  if (threads < 1 || threads > 256 || n < 1 || big_every < 1) {
+    fprintf(stderr, "usage: %s [threads<=256] [requests] [big_every]\n",
+            argv[0]);
+    return 1;
+  }
+  reqs = calloc(n, sizeof(request));
+  for (i = 0; i < n; i++) {
+    ws_task_init(&reqs[i].task, run_request);
+    reqs[i].units = (i % big_every == big_every - 1) ? BIG_UNITS : 1;
+    if (reqs[i].units > CHUNK_UNITS) {
+      reqs[i].chunks = malloc(BIG_UNITS / CHUNK_UNITS * sizeof(ws_task));
+      for (k = 0; k < BIG_UNITS / CHUNK_UNITS; k++) {
+        ws_task_init(&reqs[i].chunks[k], run_chunk);
+      }
+    }
+    total += reqs[i].units;
+  }
+
+  printf("%d threads, %d requests, 1 in %d of %d units; %ld units\n",
+         threads, n, big_every, BIG_UNITS, total);
+  printf("%-12s %10s %12s\n", "pool", "seconds", "requests/s");
+  for (k = 0; k < 3; k++) {
+    if ((secs = run(kinds[k], threads, reqs, n, total)) < 0) {
+      printf("%-12s %10s\n", names[k], "LOST");
+    } else {
+      printf("%-12s %10.3f %12.0f\n", names[k], secs, n / secs);
+    }
+    fflush(stdout);
+  }
+
+  for (i = 0; i < n; i++) {
+    free(reqs[i].chunks);
+  }
+  free(reqs);
+  return 0;
+}